@@ -16,7 +16,7 @@
 // 为了缓解磁盘内存访问速度的差异. 在内存中用固定大小的缓存链表, 缓存固定数量的磁盘块副本
 // 在内存分配能缓存 NBUF 个 "磁盘块" 的 "缓冲区" 缓存. 一个 buf 存储一个磁盘块
 // 硬件的读写单位是 512B 大小 的"扇区"
-// "磁盘块" 是 OS 人为的概念, 块大小是扇区大小的整数倍. xv6 为 1024B
+// "磁盘块" 是 OS 人为的概念, 块大小是扇区大小的整数倍. xv6 默认为 1024B, 可在编译时选择 4096B (FSBSIZE)
 //
 // 文件系统中 Cache 层的上层以磁盘块为单位, 经过 Cache 层, 逐块访问 "磁盘块" 
 // (加引号是因为可能在缓存, 而不是真的从磁盘访问)
@@ -48,6 +48,11 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+
+#if BSIZE > PGSIZE
+#error "BSIZE must not exceed PGSIZE"
+#endif
 
 // most-recently-used list
 struct {
@@ -73,19 +78,6 @@ struct {
   //    这就使缓存的老磁盘块数据 [被解释为无效]
   //    再返回被替换的 buf, 读新的磁盘块, 写进该 buf. 才重新设置 buf.valid==1
   //    从使 buf 中的磁盘块无效, 到返回该 buf, 重新写新磁盘块到这个 buf 的期间 buf.valid==0
-  // 
-  // buf.disk 表示该缓冲区内容有没有 [被磁盘持有] 
-  // 在将写入磁盘块前, Cache上层先写磁盘块缓存, 再把磁盘块缓存用 bwrite(buf) 真正写入磁盘块
-  // bwrite(buf) 调用驱动的 top-part, 在写入完磁盘块前, 设置 buf.disk 为 "未写入"
-  // 然后线程在磁盘驱动 top-part 的函数进入 sleep, 在该 buf 等待
-  // 实际写入完成后, 在任意其他线程 trap 进中断处理程序 kerneltrap 或 usertrap
-  // kerneltrap 或 usertrap 检查中断类型和中断号, 调用磁盘驱动 bottom-part
-  // 即磁盘驱动的中断处理程序, 在 xv6 是 virtio_disk_intr
-  // 磁盘驱动的 top/bottom-part 在内核全局变量范围内, 记录当前磁盘处理的请求对应的磁盘请求号 id
-  // virtio_disk_intr() 即驱动的 bottom-part 会找到当前的磁盘请求号 id
-  // 磁盘请求号可以关联到磁盘中断对应磁盘请求的相关信息, 包括请求相关的 buf
-  // 然后更新 buf.disk, wakeup(buf) 唤醒在 buf 等待的线程, 该线程再从 sleep 返回到磁盘驱动
-  // 线程在醒来, 返回到磁盘驱动后检查 buf.disk, 检查有没有完成写入到磁盘
   struct buf buf[NBUF];
 
   // Linked list of all buffers, through prev/next.
@@ -101,8 +93,20 @@ void
 binit(void)
 {
   struct buf *b;
+  char *pg;
+  int i;
+
   initlock(&bcache.lock, "bcache");
 
+  // 数据区来自 kalloc() 的页, 每页切成 PGSIZE/BSIZE 个块.
+  // BSIZE == PGSIZE 时每个 buf 恰好占一整页, bsteal() 才能把页交给用户
+  pg = 0;
+  for(i = 0; i < NBUF; i++){
+    if(i % (PGSIZE/BSIZE) == 0 && (pg = kalloc()) == 0)
+      panic("binit: kalloc");
+    bcache.buf[i].data = (uchar*)pg + (i % (PGSIZE/BSIZE)) * BSIZE;
+  }
+
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
@@ -194,6 +198,37 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// Claim a buffer for block blockno of dev, if the block is not
+// cached and some buffer is unused, without ever sleeping for
+// one. Returns it locked and not valid, or 0.
+static struct buf*
+bgetfree(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      release(&bcache.lock);
+      return 0;
+    }
+  }
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if(b->refcnt == 0) {
+      b->dev = dev;
+      b->blockno = blockno;
+      b->valid = 0;
+      b->refcnt = 1;
+      release(&bcache.lock);
+      // refcnt was 0, so nobody holds the lock: this cannot sleep.
+      acquiresleep(&b->lock);
+      return b;
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
 // Return a locked buf with the contents of the indicated block.
 // 返回在内存中缓存的磁盘块 buf 前，会获得该 buf 的锁. 读写 buf 的临界区上锁
 // 而唯一获得 buf 的途径是通过 bread()
@@ -201,12 +236,53 @@ bget(uint dev, uint blockno)
 struct buf*
 bread(uint dev, uint blockno)
 {
-  struct buf *b;
+  return breadn(dev, blockno, 1, IO_META);
+}
+
+// Like bread(), but if the block has to come from disk, read
+// ahead up to n-1 blocks after it in the same request and leave
+// them in the cache for the caller's next bread()s. Read-ahead
+// stops at the first block that is already cached or finds no
+// unused buffer, rather than waiting, so it cannot deadlock
+// with other holders of buffers.
+// origin says what the blocks hold, for iostat. IO_META is the
+// default, so it leaves the origin of a cached block alone.
+struct buf*
+breadn(uint dev, uint blockno, int n, int origin)
+{
+  struct buf *b, *ra[BIOMAX];
+  struct bio bio;
+  int i;
 
   b = bget(dev, blockno);
-  if(!b->valid) {
-    virtio_disk_rw(b, 0);
-    b->valid = 1;
+  if(!b->valid || origin != IO_META)
+    b->origin = origin;
+  if(b->valid){
+    b->flags &= ~B_FRESH;
+    return b;
+  }
+
+  if(n > BIOMAX)
+    n = BIOMAX;
+  bio.dev = dev;
+  bio.blockno = blockno;
+  bio.write = 0;
+  bio.endio = 0;
+  bio.flags = BIO_POLL;
+  bio.origin = origin;
+  bio.n = 1;
+  bio.data[0] = b->data;
+  while(bio.n < n && (ra[bio.n] = bgetfree(dev, blockno + bio.n)) != 0){
+    bio.data[bio.n] = ra[bio.n]->data;
+    bio.n++;
+  }
+  bio_rw(&bio);
+  b->valid = 1;
+  b->flags |= B_FRESH;
+  for(i = 1; i < bio.n; i++){
+    ra[i]->valid = 1;
+    ra[i]->origin = origin;
+    brelse(ra[i]);
   }
   return b;
 }
@@ -215,9 +291,96 @@ bread(uint dev, uint blockno)
 void
 bwrite(struct buf *b)
 {
+  bwritev(&b, 1);
+}
+
+// Write the n locked buffers in b[] to disk, with each run of
+// consecutive block numbers in as few requests as BIOMAX allows.
+// All the requests are in flight together, so this waits about
+// one disk round trip rather than one per run. Runs also end
+// where the blocks' origins differ, for iostat.
+// Sorts b[] by block number.
+void
+bwritev(struct buf **b, int n)
+{
+  struct buf *t;
+  struct bio *bio, *head, **tail;
+  int i, j;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&b[i]->lock))
+      panic("bwrite");
+  }
+  for(i = 1; i < n; i++){
+    t = b[i];
+    for(j = i; j > 0 && b[j-1]->blockno > t->blockno; j--)
+      b[j] = b[j-1];
+    b[j] = t;
+  }
+
+  head = 0;
+  tail = &head;
+  for(i = 0; i < n; i += bio->n){
+    bio = bio_alloc();
+    bio->dev = b[i]->dev;
+    bio->blockno = b[i]->blockno;
+    bio->write = 1;
+    bio->origin = b[i]->origin;
+    while(i + bio->n < n && bio->n < BIOMAX &&
+          b[i + bio->n]->dev == bio->dev &&
+          b[i + bio->n]->origin == bio->origin &&
+          b[i + bio->n]->blockno == bio->blockno + bio->n){
+      bio->data[bio->n] = b[i + bio->n]->data;
+      bio->n++;
+    }
+    bio_submit(bio);
+    *tail = bio;
+    tail = &bio->next;
+  }
+
+  while((bio = head) != 0){
+    head = bio->next;
+    bio_wait(bio);
+    bio_free(bio);
+  }
+}
+
+// Trade the page holding b's data for the page *pa, setting
+// *pa to b's old page, so a block can move to user memory
+// without a copy. b is left invalid and is re-read from disk
+// when next used, so this is only done for a block that the
+// breadn() handing it out just read from disk (B_FRESH): a
+// block that was already cached stays cached, and is copied.
+// Never for a B_NOSTEAL buf, whose data is not ours to give and
+// which need not even be locked.
+// Only possible when a block fills a page, so never with
+// 1024-byte blocks, and nobody else holds b; in particular the
+// log must not have it pinned, since it would later write
+// b->data to disk.
+// Returns 0 on success, -1 if the caller must copy instead.
+int
+bsteal(struct buf *b, uchar **pa)
+{
+  uchar *p;
+
+  if(b->flags & B_NOSTEAL)
+    return -1;
   if(!holdingsleep(&b->lock))
-    panic("bwrite");
-  virtio_disk_rw(b, 1);
+    panic("bsteal");
+  if(BSIZE != PGSIZE || !(b->flags & B_FRESH))
+    return -1;
+  acquire(&bcache.lock);
+  if(b->refcnt != 1){
+    release(&bcache.lock);
+    return -1;
+  }
+  p = b->data;
+  b->data = *pa;
+  *pa = p;
+  b->valid = 0;
+  b->flags &= ~B_FRESH;
+  release(&bcache.lock);
+  return 0;
 }
 
 // Release a locked buffer.
@@ -0,0 +1,437 @@
+// Block request layer.
+//
+// Moves struct bio requests between the file system and the
+// disk driver without making the submitter wait for each one:
+// bio_submit() queues a request and returns, bio_wait() waits
+// for it, so a caller can put a whole batch in flight and then
+// wait once.
+//
+// Each block device's driver registers itself in bdevsw[], by
+// device number, with how many requests it can take at once.
+// Requests wait in an I/O scheduler until their device's driver
+// has room for them. There is one queue per I/O
+// priority class (see ioprio.h), kept sorted by device and
+// block number. The scheduler takes from the first class with
+// anything queued, in elevator order (the next block at or
+// after where the last request to the same device ended, then
+// on to the next device with requests queued, wrapping round),
+// except that the request waiting longest past its deadline
+// goes next. A request leaves together with any queued
+// requests for the blocks right after it, in one driver request.
+// Idle-class requests go to the driver only when nothing else
+// is there, so a process reading with the default class is
+// never stuck behind a queue full of idle-class requests.
+//
+// Interface:
+// * bio_alloc() / bio_free() take requests from a fixed pool,
+//   for callers that need more of them than fit on the stack.
+// * bio_submit() starts a request; bio_wait() waits for it;
+//   bio_rw() does both.
+// * The driver calls bio_endio() when a request completes, from
+//   its interrupt handler and with its queue lock held, then
+//   blk_run() once it has released that lock. If the submitter
+//   set bio->endio, it runs in bio_endio() with blk.lock held,
+//   so it must not sleep or take sleep-locks (brelse() included).
+// * bio_wait() may first poll the driver for a while (see
+//   iopoll()), for requests quick enough that the interrupt,
+//   wakeup and reschedule would cost more than the I/O.
+// * Per-device counters and log2 latency histograms, by where
+//   the request came from and how it completed, are returned by
+//   blkstat() for the iostat() system call.
+//
+// 请求的提交和完成解耦: 提交后不等待, 由中断处理程序完成请求
+// 调用者可以先提交一批请求, 再统一等待
+// 锁的顺序: 驱动的队列锁在 blk.lock 之前
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "iostat.h"
+
+#define NBIO      (2*NBUF)  // at least NBUF, for bwritev() of every buffer
+
+// ticks a request may wait before it goes ahead of elevator
+// order. reads hold up their caller; writes mostly do not.
+#define READ_EXPIRE   2
+#define WRITE_EXPIRE  20
+
+#define TIMEBASE  10    // r_time() counts per microsecond on qemu virt
+#define POLL_US   100   // how long bio_wait() polls before sleeping
+
+struct {
+  struct spinlock lock;
+  struct bio pool[NBIO];
+  struct bio *free;             // unused requests, through next
+  struct bio *queue[NIOPRIO];   // waiting, sorted by dev, blockno
+  int inflight;                 // requests at the drivers
+  uint dev;                     // device of the last dispatched
+  uint pos[NDISK];              // block after the last dispatched, by device
+  int poll;                     // IOPOLL_*
+  struct iostat stat[NDISK];
+  uint64 busysince[NDISK];      // r_time() when inflight last left 0
+} blk;
+
+struct bdevsw bdevsw[NDISK];
+
+void
+blkinit(void)
+{
+  int i;
+
+  initlock(&blk.lock, "blk");
+  for(i = 0; i < NBIO; i++){
+    blk.pool[i].next = blk.free;
+    blk.free = &blk.pool[i];
+  }
+  blk.poll = IOPOLL_FLAGGED;
+}
+
+// Set the completion polling mode, unless mode is -1, and
+// return the old one.
+int
+blkpoll(int mode)
+{
+  int old;
+
+  acquire(&blk.lock);
+  old = blk.poll;
+  if(mode >= 0)
+    blk.poll = mode;
+  release(&blk.lock);
+  return old;
+}
+
+// Take a request from the pool, waiting for one if need be.
+struct bio*
+bio_alloc(void)
+{
+  struct bio *bio;
+
+  acquire(&blk.lock);
+  while(blk.free == 0)
+    sleep(&blk.free, &blk.lock);
+  bio = blk.free;
+  blk.free = bio->next;
+  release(&blk.lock);
+  bio->n = 0;
+  bio->endio = 0;
+  bio->flags = 0;
+  bio->origin = IO_META;
+  bio->private = 0;
+  bio->next = 0;
+  return bio;
+}
+
+// Return a request to the pool. Caller holds blk.lock.
+static void
+putfree(struct bio *bio)
+{
+  bio->next = blk.free;
+  blk.free = bio;
+  wakeup(&blk.free);
+}
+
+// Return a completed request to the pool.
+void
+bio_free(struct bio *bio)
+{
+  acquire(&blk.lock);
+  putfree(bio);
+  release(&blk.lock);
+}
+
+// Can queued request nb carry on from the n blocks starting at
+// b->blockno, in the same driver request?
+static int
+adjacent(struct bio *b, int n, struct bio *nb)
+{
+  return nb != 0 && nb->dev == b->dev && nb->write == b->write &&
+    nb->blockno == b->blockno + n && n + nb->n <= BIOMAX;
+}
+
+// Build one request from b, just taken off its queue, and the
+// requests after it that adjacent() allows; *pp is the first of
+// those. Without a spare bio to carry them, b goes alone.
+static struct bio*
+merge(struct bio *b, struct bio **pp)
+{
+  struct bio *m, *t, *last;
+  int i;
+
+  if(!adjacent(b, b->n, *pp) || blk.free == 0)
+    return b;
+  m = blk.free;
+  blk.free = m->next;
+  m->dev = b->dev;
+  m->blockno = b->blockno;
+  m->write = b->write;
+  m->n = 0;
+  m->parts = b;
+  b->qnext = 0;
+  for(t = last = b; t != 0; t = adjacent(m, m->n, *pp) ? *pp : 0){
+    if(t != b){
+      *pp = t->qnext;
+      t->qnext = 0;
+      last->qnext = t;
+      last = t;
+      blk.stat[t->dev].queued--;
+      blk.stat[t->dev].merges++;
+    }
+    for(i = 0; i < t->n; i++)
+      m->data[m->n++] = t->data[i];
+  }
+  return m;
+}
+
+// In the queue starting at *pp, find the link to the first
+// request for device dev at or after block pos, or if there is
+// none and wrap is set, to dev's first request. Returns 0 if
+// there is no such request.
+static struct bio**
+seek(struct bio **pp, uint dev, uint pos, int wrap)
+{
+  struct bio **first = 0;
+
+  for(; *pp && (*pp)->dev <= dev; pp = &(*pp)->qnext){
+    if((*pp)->dev < dev)
+      continue;
+    if((*pp)->blockno >= pos)
+      return pp;
+    if(first == 0)
+      first = pp;
+  }
+  return wrap ? first : 0;
+}
+
+// Does dev's driver have as many requests as it can take?
+static int
+full(uint dev)
+{
+  return blk.stat[dev].inflight >= bdevsw[dev].depth;
+}
+
+// Take the next request to dispatch off the queues, or return 0.
+// Requests for a device whose driver is full stay queued.
+// Caller holds blk.lock.
+static struct bio*
+pick(void)
+{
+  struct bio **pp, **exp, *b;
+  int c, i;
+  uint d;
+
+  for(c = 0; c < NIOPRIO; c++){
+    if(blk.queue[c] == 0)
+      continue;
+    if(c == IOPRIO_IDLE && blk.inflight > 0)
+      return 0;
+    // the oldest expired request, if any.
+    exp = 0;
+    for(pp = &blk.queue[c]; *pp; pp = &(*pp)->qnext){
+      if(!full((*pp)->dev) && (int)(ticks - (*pp)->deadline) >= 0 &&
+         (exp == 0 || (int)((*pp)->deadline - (*exp)->deadline) < 0))
+        exp = pp;
+    }
+    pp = exp;
+    // else elevator order: onward on this device, then the
+    // other devices in turn, and last this device again from
+    // its lowest block.
+    for(i = 0; pp == 0 && i <= NDISK; i++){
+      d = (blk.dev + i) % NDISK;
+      if(!full(d))
+        pp = seek(&blk.queue[c], d, blk.pos[d], i > 0);
+    }
+    if(pp == 0)
+      continue;
+    b = *pp;
+    *pp = b->qnext;
+    blk.stat[b->dev].queued--;
+    return merge(b, pp);
+  }
+  return 0;
+}
+
+// Hand queued requests to the drivers while they have room.
+void
+blk_run(void)
+{
+  struct bio *b, *t;
+
+  acquire(&blk.lock);
+  while((b = pick()) != 0){
+    if(b->parts == 0)
+      __atomic_store_n(&b->dispatched, 1, __ATOMIC_RELEASE);
+    for(t = b->parts; t != 0; t = t->qnext)
+      __atomic_store_n(&t->dispatched, 1, __ATOMIC_RELEASE);
+    blk.inflight++;
+    if(blk.stat[b->dev].inflight++ == 0)
+      blk.busysince[b->dev] = r_time();
+    blk.dev = b->dev;
+    blk.pos[b->dev] = b->blockno + b->n;
+    release(&blk.lock);
+    bdevsw[b->dev].submit(b);
+    acquire(&blk.lock);
+  }
+  release(&blk.lock);
+}
+
+// Queue bio and return without waiting for it to complete.
+// Its priority class is the current process's.
+void
+bio_submit(struct bio *bio)
+{
+  struct proc *p = myproc();
+  struct bio **pp;
+
+  if(bio->n < 1 || bio->n > BIOMAX || bio->dev >= NDISK ||
+     bdevsw[bio->dev].submit == 0)
+    panic("bio_submit");
+  bio->done = 0;
+  bio->parts = 0;
+  bio->dispatched = 0;
+  bio->prio = p ? p->ioprio : IOPRIO_BE;
+
+  acquire(&blk.lock);
+  bio->start = r_time();
+  bio->deadline = ticks + (bio->write ? WRITE_EXPIRE : READ_EXPIRE);
+  blk.stat[bio->dev].queued++;
+  for(pp = &blk.queue[bio->prio]; *pp; pp = &(*pp)->qnext){
+    if((*pp)->dev > bio->dev ||
+       ((*pp)->dev == bio->dev && (*pp)->blockno > bio->blockno))
+      break;
+  }
+  bio->qnext = *pp;
+  *pp = bio;
+  release(&blk.lock);
+
+  blk_run();
+}
+
+// Wait for a submitted request to complete, polling the driver
+// for up to POLL_US first if the polling mode asks for it. Only
+// a request already at a driver that can be polled is worth
+// polling for; one still queued here waits for others first.
+void
+bio_wait(struct bio *bio)
+{
+  void (*poll)(void) = bdevsw[bio->dev].poll;
+  uint64 end;
+
+  if(poll && __atomic_load_n(&bio->dispatched, __ATOMIC_ACQUIRE) &&
+     (blk.poll == IOPOLL_ALL ||
+      (blk.poll == IOPOLL_FLAGGED && (bio->flags & BIO_POLL)))){
+    end = r_time() + POLL_US * TIMEBASE;
+    while(__atomic_load_n(&bio->done, __ATOMIC_ACQUIRE) == 0 && r_time() < end)
+      poll();
+  }
+
+  acquire(&blk.lock);
+  while(bio->done == 0)
+    sleep(bio, &blk.lock);
+  release(&blk.lock);
+}
+
+// Perform bio and wait for it.
+void
+bio_rw(struct bio *bio)
+{
+  bio_submit(bio);
+  bio_wait(bio);
+}
+
+// Finish one submitted request. Caller holds blk.lock.
+static void
+complete(struct bio *bio, int polled)
+{
+  struct iostat *st = &blk.stat[bio->dev];
+  uint t = (r_time() - bio->start) / TIMEBASE;
+  int i;
+
+  if(bio->write){
+    st->writes++;
+    st->wsectors += bio->n * (BSIZE / 512);
+  } else {
+    st->reads++;
+    st->rsectors += bio->n * (BSIZE / 512);
+  }
+  for(i = 0; i < NIOHIST-1 && (t >> (i+1)) != 0; i++)
+    ;
+  st->origin[bio->origin]++;
+  st->hist[bio->origin][i]++;
+  if(polled)
+    st->pollhist[i]++;
+  else
+    st->intrhist[i]++;
+  st->prio[bio->prio]++;
+  st->priotime[bio->prio] += t;
+  if(t > st->priomax[bio->prio])
+    st->priomax[bio->prio] = t;
+
+  bio->done = 1;
+  if(bio->endio)
+    bio->endio(bio);
+  wakeup(bio);
+}
+
+// The driver is done with bio, which may carry several merged
+// requests. Called with the driver's lock held; polled says
+// whether it completed without an interrupt.
+void
+bio_endio(struct bio *bio, int polled)
+{
+  struct iostat *st = &blk.stat[bio->dev];
+  struct bio *t;
+
+  acquire(&blk.lock);
+  blk.inflight--;
+  if(--st->inflight == 0)
+    st->busy += (r_time() - blk.busysince[bio->dev]) / TIMEBASE;
+  if(bio->parts){
+    while((t = bio->parts) != 0){
+      bio->parts = t->qnext;
+      complete(t, polled);
+    }
+    putfree(bio);
+  } else {
+    complete(bio, polled);
+  }
+  release(&blk.lock);
+}
+
+// Copy dev's counters to *st. Returns -1 for no such device.
+int
+blkstat(uint dev, struct iostat *st)
+{
+  if(dev >= NDISK || bdevsw[dev].submit == 0)
+    return -1;
+  acquire(&blk.lock);
+  *st = blk.stat[dev];
+  if(st->inflight > 0)
+    st->busy += (r_time() - blk.busysince[dev]) / TIMEBASE;
+  release(&blk.lock);
+  return 0;
+}
+
+// Print each device's request counts and latencies.
+// Runs when user types ^P on console, without the lock, like
+// procdump(); the iostat program shows more.
+void
+blkdump(void)
+{
+  struct iostat *st;
+  int d;
+
+  for(d = 0; d < NDISK; d++){
+    st = &blk.stat[d];
+    if(st->reads + st->writes + st->queued + st->inflight == 0)
+      continue;
+    printf("disk %d: %d reads %d writes, %d queued %d at driver, busy %d us\n",
+           d, st->reads, st->writes, st->queued, st->inflight, (int)st->busy);
+  }
+}
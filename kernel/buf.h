@@ -1,12 +1,53 @@
 struct buf {
   int valid;   // has data been read from disk?
-  int disk;    // does disk "own" buf?
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes, carved from kalloc()ed pages
+  int origin;       // IO_*: what the block holds, for iostat
+  int flags;        // B_*
 };
 
+#define B_FRESH   0x1   // read from disk by the breadn() that returned it
+#define B_NOSTEAL 0x2   // not a cache buf: bsteal() must never take its page
+
+// One disk request: n consecutive blocks starting at blockno,
+// each transferred to or from its own BSIZE bytes at data[i].
+// See blk.c.
+struct bio {
+  uint dev;
+  uint blockno;
+  int write;
+  int n;
+  uchar *data[BIOMAX];
+  int done;                     // set by bio_endio()
+  void (*endio)(struct bio*);   // if set, run by bio_endio()
+  void *private;                // for endio
+  struct bio *next;             // caller's batch, or blk's free list
+  int flags;                    // BIO_*
+  int origin;                   // IO_*, for iostat
+
+  // private to blk.c
+  int prio;                     // I/O priority class
+  uint64 start;                 // r_time() when submitted
+  uint deadline;                // dispatch by this many ticks
+  struct bio *qnext;            // scheduler queue, or parts list
+  struct bio *parts;            // requests merged into this one
+  int dispatched;               // handed to the driver
+};
+
+#define BIO_POLL  0x1   // the submitter will wait for it at once
+
+// Block device drivers, by device number. See blk.c.
+struct bdevsw {
+  void (*submit)(struct bio*);  // start a request; must not sleep
+  void (*poll)(void);           // complete finished requests, or 0
+  int depth;                    // most requests it can take at once
+};
+
+extern struct bdevsw bdevsw[];
+
+
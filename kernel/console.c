@@ -203,6 +203,7 @@ consoleintr(int c)
   switch(c){
   case C('P'):  // Print process list.
     procdump();
+    blkdump();
     break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
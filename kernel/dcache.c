@@ -0,0 +1,194 @@
+// Directory entry cache.
+//
+// Remembers the result of recent dirlookup() calls: for a
+// directory (dev, inum) and a name, the inode number the name
+// refers to and the byte offset of its dirent, or that the name
+// is not there (a negative entry, inum 0). A hit lets dirlookup()
+// skip reading the directory.
+//
+// Interface:
+// * dclookup() looks up a name; dcenter() records the result of
+//   a directory scan, and is also called whenever a dirent is
+//   written or cleared, to keep the entry for that name right.
+// * dcpurge() forgets every name in a directory, when its
+//   dirents move or the directory inode is freed.
+// * Callers hold the directory's inode lock, so an entry cannot
+//   change between a scan and the dcenter() that records it.
+//
+// 以 (dev, 目录 inum, name) 为键, 缓存 (inum, off)
+// 每个键按哈希挂在 NDCHASH 个链表之一上; 所有表项另外按最近使用的顺序
+// 串成一个双向链表, 替换时选最久未使用的表项, 与 bcache 相同
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDCHASH 31
+
+struct dentry {
+  uint dev;
+  uint dinum;           // directory holding the name; 0 if unused
+  char name[DIRSIZ];
+  uint inum;            // 0: name known not to exist
+  uint off;             // byte offset of the dirent in the directory
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDCHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used, head.prev is least.
+  struct dentry head;
+} dcache;
+
+void
+dcinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static uint
+dchash(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDCHASH;
+}
+
+// Find the entry for (dp, name). Caller holds dcache.lock.
+static struct dentry*
+dcfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dchash(dev, dinum, name)]; d; d = d->hnext){
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Take d off its hash chain and mark it unused.
+// Caller holds dcache.lock.
+static void
+dcunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dchash(d->dev, d->dinum, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dinum = 0;
+}
+
+// Move d to the least-recently-used end, to be reused first.
+static void
+dctail(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->prev = dcache.head.prev;
+  d->next = &dcache.head;
+  dcache.head.prev->next = d;
+  dcache.head.prev = d;
+}
+
+// Move d to the most-recently-used end.
+static void
+dchead(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Look up name in directory dp.
+// Returns 1 and sets *inum (0 if the name does not exist)
+// and *off if the answer is cached, 0 if not.
+int
+dclookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dchead(d);
+  *inum = d->inum;
+  *off = d->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum, with its
+// dirent at byte offset off, or does not exist if inum is 0.
+void
+dcenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    // recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->dinum)
+      dcunhash(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->hnext = dcache.hash[dchash(d->dev, d->dinum, d->name)];
+    dcache.hash[dchash(d->dev, d->dinum, d->name)] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dchead(d);
+  release(&dcache.lock);
+}
+
+// Forget every name in directory (dev, dinum).
+void
+dcpurge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    if(d->dinum == dinum && d->dev == dev){
+      dcunhash(d);
+      dctail(d);
+    }
+  }
+  release(&dcache.lock);
+}
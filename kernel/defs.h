@@ -1,21 +1,44 @@
+struct bio;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct iostat;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct statfs;
 struct superblock;
 
+// moves file content to or from a cached block; see readi_actor()
+typedef int (*iactor)(void*, struct buf*, uint, uint);
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+struct buf*     breadn(uint, uint, int, int);
+void            bwritev(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bsteal(struct buf*, uchar**);
+
+// blk.c
+void            blkinit(void);
+void            blk_run(void);
+void            blkdump(void);
+int             blkpoll(int);
+int             blkstat(uint, struct iostat*);
+struct bio*     bio_alloc(void);
+void            bio_free(struct bio*);
+void            bio_submit(struct bio*);
+void            bio_wait(struct bio*);
+void            bio_rw(struct bio*);
+void            bio_endio(struct bio*, int);
 
 // console.c
 void            consoleinit(void);
@@ -33,12 +56,28 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesend(struct file*, struct file*, int, int);
+int             filesplice(struct file*, struct file*, int);
+int             filepread(struct file*, uint64, int, uint);
+int             filepwrite(struct file*, uint64, int, uint);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filelseek(struct file*, int, int);
+int             filefallocate(struct file*, uint, uint);
+int             filesync(struct file*, int);
 
 // fs.c
 void            fsinit(int);
+void            fsstat(uint, struct statfs*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+int             dirunlink(struct inode*, char*, uint);
+struct inode*   dirscan(struct inode*, char*, uint*);
+int             dirappend(struct inode*, char*, uint);
+int             direrase(struct inode*, char*, uint);
+int             fsmount(struct inode*, char*);
+int             mntpoint(struct inode*);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -50,14 +89,25 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readi_actor(struct inode*, uint, uint, iactor, void*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writei_actor(struct inode*, uint, uint, iactor, void*);
 void            itrunc(struct inode*);
+void            iplace(struct inode*, uint, uint);
+int             falloci(struct inode*, uint, uint);
+
+// dcache.c
+void            dcinit(void);
+int             dclookup(struct inode*, char*, uint*, uint*);
+void            dcenter(struct inode*, char*, uint, uint);
+void            dcpurge(uint, uint);
 
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+
+// tmpfs.c
+void            tmpinit(void);
 
 // kalloc.c
 void*           kalloc(void);
@@ -67,6 +117,9 @@ void            kinit(void);
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_write_data(struct buf*);
+uint            log_tid(void);
+void            log_force(uint);
 void            begin_op(void);
 void            end_op(void);
 
@@ -75,6 +128,9 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipewait(struct pipe*, int);
+int             pipefill(void*, struct buf*, uint, uint);
+int             pipedrain(void*, struct buf*, uint, uint);
 
 // printf.c
 int            printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
@@ -106,6 +162,7 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kproc(char*, void (*)(void));
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -182,7 +239,8 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct bio *);
+void            virtio_disk_poll(void);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
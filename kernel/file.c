@@ -27,7 +27,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "fcntl.h"
 #include "proc.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
 
@@ -118,6 +120,80 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read cnt user buffers in turn from ip at *off, advancing *off,
+// under one hold of the inode lock. Stops at the first short read.
+// Returns the number of bytes read, or -1.
+static int
+inoderead(struct inode *ip, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r, tot;
+
+  tot = 0;
+  ilock(ip);
+  for(i = 0; i < cnt; i++){
+    if((r = readi(ip, 1, (uint64)iov[i].iov_base, *off, iov[i].iov_len)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    *off += r;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  iunlock(ip);
+  return tot;
+}
+
+// Write cnt user buffers in turn to ip at *off, advancing *off.
+// The pieces land back to back in the file, so they are packed
+// into as few log transactions as the size bound allows rather
+// than one transaction per piece.
+// Returns the number of bytes written, which is short on error.
+static int
+inodewrite(struct inode *ip, struct iovec *iov, int cnt, uint *off)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i, r, n1, room, tot, bad;
+  uint64 done;    // bytes of iov[i] already written
+
+  i = tot = bad = 0;
+  done = 0;
+  while(i < cnt && !bad){
+    begin_op();
+    ilock(ip);
+    for(room = max; i < cnt && room > 0; ){
+      n1 = iov[i].iov_len - done;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(ip, 1, (uint64)iov[i].iov_base + done, *off, n1)) > 0){
+        *off += r;
+        tot += r;
+        done += r;
+        room -= r;
+      }
+      if(r != n1){
+        // error from writei
+        bad = 1;
+        break;
+      }
+      if(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
+    }
+    iunlock(ip);
+    end_op();
+  }
+  return tot;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -156,7 +232,7 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
@@ -168,33 +244,10 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    struct iovec iov = { (void*)addr, n };
+    if(n < 0)
+      return -1;
+    ret = (inodewrite(f->ip, &iov, 1, &f->off) == n ? n : -1);
   } else {
     panic("filewrite");
   }
@@ -202,3 +255,318 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Copy ip's content from off into pipe pi straight out of the
+// block cache. When the pipe is full, drop the inode lock and
+// wait for the reader, so it can never wait on us.
+static int
+sendpipe(struct pipe *pi, struct inode *ip, uint off, int n)
+{
+  int r, tot;
+
+  tot = 0;
+  while(tot < n){
+    ilock(ip);
+    r = readi_actor(ip, off, n - tot, pipefill, pi);
+    if(r == 0 && off >= ip->size){
+      iunlock(ip);
+      break;
+    }
+    iunlock(ip);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    off += r;
+    if(r == 0 && pipewait(pi, 1) < 0)
+      return tot > 0 ? tot : -1;
+  }
+  return tot;
+}
+
+// Copy ip's content from off to the end of file f through one
+// kernel page, never touching user memory.
+static int
+sendinode(struct file *f, struct inode *ip, uint off, int n)
+{
+  char *kbuf;
+  int r, w, n1, tot;
+  // same transaction bound as filewrite()
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+
+  if(max > PGSIZE)
+    max = PGSIZE;
+  if((kbuf = kalloc()) == 0)
+    return -1;
+  tot = 0;
+  while(tot < n){
+    n1 = n - tot;
+    if(n1 > max)
+      n1 = max;
+    ilock(ip);
+    r = readi(ip, 0, (uint64)kbuf, off + tot, n1);
+    iunlock(ip);
+    if(r <= 0)
+      break;
+
+    begin_op();
+    ilock(f->ip);
+    if((w = writei(f->ip, 0, (uint64)kbuf, f->off, r)) > 0)
+      f->off += w;
+    iunlock(f->ip);
+    end_op();
+
+    if(w > 0)
+      tot += w;
+    if(w != r)
+      break;
+  }
+  kfree(kbuf);
+  return tot;
+}
+
+// Move up to n bytes of file in to file out (a pipe or an
+// inode) without a round trip through user space. Read from
+// off, or from in's offset, advancing it, when off is -1.
+// Returns the number of bytes moved, or -1.
+int
+filesend(struct file *out, struct file *in, int off, int n)
+{
+  int r, useoff;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_INODE)
+    return -1;
+  useoff = (off == -1);
+  if(useoff)
+    off = in->off;
+  else if(off < 0)
+    return -1;
+
+  if(out->type == FD_PIPE)
+    r = sendpipe(out->pipe, in->ip, off, n);
+  else if(out->type == FD_INODE)
+    r = sendinode(out, in->ip, off, n);
+  else
+    return -1;
+
+  if(useoff && r > 0)
+    in->off += r;
+  return r;
+}
+
+// Move up to n bytes between a pipe and an inode: file to pipe
+// is filesend(); pipe to file drains the pipe straight into the
+// block cache, waiting for more data until n bytes have moved or
+// every writer has gone.
+// Returns the number of bytes moved, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  int r, n1, tot;
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return filesend(out, in, -1, n);
+  if(in->type != FD_PIPE || out->type != FD_INODE)
+    return -1;
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+
+  tot = 0;
+  while(tot < n){
+    // 等待不能放在事务和 inode 锁里面: 管道的写者可能正需要它们
+    if((r = pipewait(in->pipe, 0)) < 0)
+      return tot > 0 ? tot : -1;
+    if(r == 0)
+      break;
+    // ask for no more than the pipe holds: writei_actor() maps a
+    // block before pipedrain() fills it, and one that got nothing
+    // would sit past the end of the file.
+    n1 = n - tot;
+    if(n1 > r)
+      n1 = r;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
+    ilock(out->ip);
+    if((r = writei_actor(out->ip, out->off, n1, pipedrain, in->pipe)) > 0)
+      out->off += r;
+    iunlock(out->ip);
+    end_op();
+
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r == 0)
+      break;    // out of disk space
+    tot += r;
+  }
+  return tot;
+}
+
+// Read from file f at offset off, leaving f's offset alone.
+// addr is a user virtual address.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov = { (void*)addr, n };
+
+  if(f->readable == 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  return inoderead(f->ip, &iov, 1, &off);
+}
+
+// Write to file f at offset off, leaving f's offset alone.
+// addr is a user virtual address.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov = { (void*)addr, n };
+
+  if(f->writable == 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  return (inodewrite(f->ip, &iov, 1, &off) == n ? n : -1);
+}
+
+// Read from file f into cnt user buffers in turn.
+// iov is in kernel memory; the buffers it names are user memory.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return inoderead(f->ip, iov, cnt, &f->off);
+
+  // pipes and devices: a short read means nothing more for now.
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if((r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+// Write cnt user buffers in turn to file f; to an inode, in a
+// single log transaction when they fit in one.
+// iov is in kernel memory; the buffers it names are user memory.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++)
+    tot += iov[i].iov_len;
+
+  if(f->type == FD_INODE)
+    return (inodewrite(f->ip, iov, cnt, &f->off) == tot ? tot : -1);
+
+  for(i = 0; i < cnt; i++){
+    if((r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len)) != iov[i].iov_len)
+      return -1;
+  }
+  return tot;
+}
+
+// lseek() returns the new offset as an int, so no offset past
+// this can be reached; it is also below the largest file size.
+#define MAXSEEK 0x7fffffffL
+
+// Move f's offset to off bytes from the start, the current
+// offset or the end of the file, as whence says. Seeking past
+// the end is allowed; a later write there leaves a hole.
+// Returns the new offset, or -1.
+int
+filelseek(struct file *f, int off, int whence)
+{
+  long base, pos;
+
+  if(f->type != FD_INODE)
+    return -1;
+  if(whence == SEEK_SET)
+    base = 0;
+  else if(whence == SEEK_CUR)
+    base = f->off;
+  else if(whence == SEEK_END){
+    ilock(f->ip);
+    base = f->ip->size;
+    iunlock(f->ip);
+  } else
+    return -1;
+  // base is at most a uint, so this cannot overflow a long.
+  pos = base + off;
+  if(pos < 0 || pos > MAXSEEK)
+    return -1;
+  f->off = pos;
+  return pos;
+}
+
+// Allocate the blocks holding bytes [off, off+n) of file f up
+// front, as one contiguous run where the disk allows, and grow
+// the file to off+n if it is shorter. Later writes there need
+// no allocation and find their blocks in order on disk.
+// Returns 0, or -1.
+int
+filefallocate(struct file *f, uint off, uint n)
+{
+  struct inode *ip = f->ip;
+  // same transaction bound as filewrite()
+  uint max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint i, n1;
+  int r;
+
+  if(f->writable == 0 || f->type != FD_INODE || off + n < off)
+    return -1;
+  ilock(ip);
+  if(ip->type != T_FILE){
+    iunlock(ip);
+    return -1;
+  }
+  iplace(ip, off, n);
+  iunlock(ip);
+
+  // chunks start on block boundaries, so none shares a block
+  // with the one before it.
+  r = 0;
+  for(i = 0; i < n && r == 0; i += n1){
+    n1 = max - (off + i) % BSIZE;
+    if(n1 > n - i)
+      n1 = n - i;
+    begin_op();
+    ilock(ip);
+    r = falloci(ip, off + i, n1);
+    iunlock(ip);
+    end_op();
+  }
+  return r;
+}
+
+// Make f's changes durable: with datasync, just what is needed
+// to read its content back, otherwise its inode too. Commits
+// the open log transaction if it holds any of them, which only
+// matters with FS_ASYNC; otherwise every operation has already
+// committed by the time it returns.
+// Returns 0, or -1.
+int
+filesync(struct file *f, int datasync)
+{
+  uint tid;
+
+  if(f->type == FD_PIPE)
+    return -1;
+  if(f->type == FD_DEVICE)
+    return 0;
+  ilock(f->ip);
+  tid = datasync ? f->ip->dtid : f->ip->tid;
+  iunlock(f->ip);
+  log_force(tid);
+  return 0;
+}
@@ -17,12 +17,16 @@ struct file {
 struct inode {
   // inode 缓存的锁和块缓存的锁策略类似
   // 块缓存的块外部的事情，如缓存获取、绑定，用 bcache.lock, 块自己的的事情用 buf.lock
-  // inode 外部的事情，如 inode 表项获取、绑定，用，itable.lock, inode 自己的事情用 inode.lock
+  // inode 外部的事情，如 inode 表项获取、绑定，用哈希桶的锁和 itable.lock, inode 自己的事情用 inode.lock
   
-  //-----------这三个 fields 都和inode缓存的分配等 inode 外部事务相关，用 itable->lock 保护，-----------
+  //-----------这些 fields 都和inode缓存的分配等 inode 外部事务相关，用所在哈希桶的锁和 itable.lock 保护，-----------
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // hash chain, or free list
+  struct inode *prev; // LRU list of unreferenced inodes
+  struct inode *next;
+  struct iops *op;    // its file system's inode operations
   //------------------------------------------------------
 
  
@@ -35,7 +39,16 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  uint addrs[NADDRS];
+
+  // not on disk: bmap()'s copy of the last bottom-level indirect block
+  uint *ind;          // BSIZE copy from indalloc(), or 0
+  uint indaddr;       // its block number; 0 if ind holds nothing
+  uint indlbn;        // logical block number mapped by ind[0]
+  uint goal;          // where bmap() looks for the next free block; 0 if unset
+  uint tid;           // last log transaction to change the inode
+  uint dtid;          // last one to change its content, size or blocks
 };
 
 // map major device number to device functions.
@@ -46,4 +59,39 @@ struct devsw {
 
 extern struct devsw devsw[];
 
+struct buf;
+struct statfs;
+
+// file system operations. Each file system type has a vfsops
+// table, found by device number in vfssw[], and an iops table
+// that iget() gives each of its inodes. The generic inode,
+// directory and path name code in fs.c calls through them
+// wherever it would reach the file system's storage.
+struct iops {
+  void (*load)(struct inode*);     // fill in a not yet valid inode
+  void (*update)(struct inode*);   // write back the inode's fields
+  void (*free)(struct inode*);     // release its inode number
+  void (*trunc)(struct inode*);    // discard content, size 0
+  void (*place)(struct inode*, uint, uint);  // layout hint, or 0
+  int (*falloc)(struct inode*, uint, uint);
+  // readi_actor() and writei_actor(); the fourth argument is an iactor.
+  int (*read)(struct inode*, uint, uint, int (*)(void*, struct buf*, uint, uint), void*);
+  int (*write)(struct inode*, uint, uint, int (*)(void*, struct buf*, uint, uint), void*);
+  // directories; the caller holds dp locked and has asked the
+  // dentry cache. dirscan(), dirappend() and direrase() work on
+  // any directory that is a plain list of dirents.
+  struct inode* (*lookup)(struct inode*, char*, uint*);  // iget()s name, or 0
+  int (*link)(struct inode*, char*, uint);   // name is known absent
+  int (*unlink)(struct inode*, char*, uint); // entry for name at offset
+};
+
+struct vfsops {
+  char *name;                          // type name for mount()
+  uint (*ialloc)(uint, short, uint);   // returns an inode number, or 0
+  void (*statfs)(uint, struct statfs*);
+  struct iops *iops;
+};
+
+extern struct vfsops *vfssw[];
+
 #define CONSOLE 1
@@ -19,6 +19,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -26,6 +27,45 @@
 // only one device
 struct superblock sb; 
 
+// the file system on each device, by device number. The root
+// is the disk file system below from the start, since
+// userinit() looks up "/" before fsinit() runs.
+static struct vfsops diskops;
+static struct iops diskiops;
+struct vfsops *vfssw[NFSDEV] = { [ROOTDEV] = &diskops };
+
+// In-memory summary of the free bitmap, counted once at mount,
+// so that balloc() can skip full groups without reading their
+// bitmap blocks and statfs can report free space without a scan.
+// The disk is cut into ngroup groups of bpg blocks; a file's data
+// is placed in the group of its inode (see igoal()).
+// The inodes are cut into the same number of groups of ipg
+// inodes, and imap, rebuilt from the inode blocks at mount,
+// lets ialloc() find a free inode without reading any.
+struct {
+  struct spinlock lock;
+  uint bpg;              // blocks per group
+  uint ngroup;
+  uint nfree;            // free blocks in the file system
+  uint gfree[NGROUP];    // free blocks in each group
+  uint cursor;           // next-fit: where a search without a goal starts
+  uint dstart;           // first data block
+  uint ipg;              // inodes per group
+  uint nifree;           // free inodes
+  uint gifree[NGROUP];   // free inodes in each group
+  uchar *imap;           // one bit per inode, set if allocated
+} bsum;
+
+static void bsuminit(int dev);
+static void isuminit(int dev);
+
+// A block of zeros that readi_actor() hands out for the holes
+// in sparse files, which have no block of their own. Nothing
+// writes it, so it is handed out unlocked, to any number of
+// readers at once; B_NOSTEAL keeps bsteal() from handing its
+// page to one of them.
+static struct buf zerobuf;
+
 // Read the super block.
 // 从已经格式化为文件系统的磁盘中，读取 superblock 磁盘块到内存结构
 static void
@@ -33,8 +73,8 @@ readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / BSIZE);
+  memmove(sb, bp->data + SBOFF % BSIZE, sizeof(*sb));
   brelse(bp);
 }
 
@@ -45,41 +85,82 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.bsize == 0)
+    sb.bsize = 1024;  // made before the block size was recorded
+  if(sb.bsize != BSIZE){
+    printf("fsinit: file system has %d-byte blocks, kernel built for %d\n", sb.bsize, BSIZE);
+    panic("fsinit: block size");
+  }
+  sb.flags |= MNTFLAGS;
   initlog(dev, &sb);
+  bsuminit(dev);   // after recovery, so the bitmap is consistent
+  isuminit(dev);
+  if((zerobuf.data = kalloc()) == 0)
+    panic("fsinit: zerobuf");
+  memset(zerobuf.data, 0, PGSIZE);
+  zerobuf.flags = B_NOSTEAL;
 }
 
 // Zero a block.
 // 使 block 中的 bit 全部置 0
+// data 表示该块将存放文件数据而不是元数据, ordered 模式下不经过日志
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_write_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// Group holding block b, and group holding inode inum.
+#define BGROUP(b) ((b) / bsum.bpg)
+#define IGROUP(inum) ((inum) / bsum.ipg)
+
+// Count the free bits of the bitmap into bsum.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int b, bi;
+
+  initlock(&bsum.lock, "bsum");
+  bsum.bpg = (sb.size + NGROUP - 1) / NGROUP;
+  bsum.ngroup = (sb.size + bsum.bpg - 1) / bsum.bpg;
+  for(b = 0; b < sb.size; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb));
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+        bsum.nfree++;
+        bsum.gfree[BGROUP(b + bi)]++;
+      }
+    }
+    brelse(bp);
+  }
+  bsum.dstart = sb.bmapstart + (sb.size + BPB - 1) / BPB;
+  bsum.cursor = bsum.dstart;
+}
+
+// Claim the first free block in [lo, hi), zero it and
+// return its number, or return 0 if there is none.
 static uint
-balloc(uint dev)
+bscan(uint dev, uint lo, uint hi, int data)
 {
   int b, bi, m;
   struct buf *bp;
 
-  bp = 0;
-  // sb.size 是整个文件系统（包括预留的 data block）的块数量
-  // 每个块占 bitmap 的一位
-  // sb.size 可以解释为 bitmap 的最大 bit 数量
-  // 循环中是把块号解释为 bitmap 中的 bit 号
   // BBLOCK(b, sb) 计算 blockno 对应的 bitmap 中的 bit，处于磁盘的第几个 block
-  for(b = 0; b < sb.size; b += BPB){ // 每次循环 b 增加到下一个 bitmap 块的第一位；bitmap 的位数最多为文件系统的块数 sb.size
+  // 每次循环 b 为下一个 bitmap 块的第一位, 只遍历其中 [lo, hi) 内的位
+  for(b = lo - lo % BPB; b < hi; b += BPB){
     bp = bread(dev, BBLOCK(b, sb)); // 读取 bitmap 的各个磁盘块到内存结构（缓存 buf 中的 uchar 数组）
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){ // 遍历 bitmap 各个块的每一位
+    for(bi = (b < lo ? lo - b : 0); bi < BPB && b + bi < hi; bi++){ // 遍历 bitmap 各个块的每一位
       m = 1 << (bi % 8);
       // 磁盘块数据读到内存后，如何使用它？
       // 磁盘驱动复制磁盘块到内存指定的地址
@@ -137,16 +218,107 @@ balloc(uint dev)
         // 每个过程知道自己使用的空间在哪里，不使用其他空间
         // 
         // 而对于计算过程，空间是否被占用就需要用表来判断
-        bzero(dev, b + bi);
+        acquire(&bsum.lock);
+        bsum.nfree--;
+        bsum.gfree[BGROUP(b + bi)]--;
+        bsum.cursor = b + bi + 1;
+        release(&bsum.lock);
+        bzero(dev, b + bi, data);
         return b + bi;
       }
     }
     brelse(bp);
   }
+  return 0;
+}
+
+// Allocate a zeroed disk block.
+// data is non-zero if the block will hold file data
+// rather than metadata (see log_write_data()).
+// The search starts at block goal, or at the next-fit cursor
+// if goal is 0, and wraps around, so a caller that passes the
+// block after its previous one gets contiguous blocks whenever
+// they are free. Groups the summary shows to be full are
+// skipped without reading their bitmap.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, int data, uint goal)
+{
+  uint g, gi, lo, hi, b, nfree;
+  int n;
+
+  acquire(&bsum.lock);
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.cursor < sb.size ? bsum.cursor : 0;
+  release(&bsum.lock);
+
+  // 从 goal 所在组的 goal 位开始, 依次遍历之后的组
+  // 绕回后最后一次 (n == ngroup) 再遍历 goal 所在组中 goal 之前的位
+  g = BGROUP(goal);
+  for(n = 0; n <= bsum.ngroup; n++){
+    gi = (g + n) % bsum.ngroup;
+    lo = gi * bsum.bpg;
+    hi = min(lo + bsum.bpg, sb.size);
+    if(n == 0)
+      lo = goal;
+    else if(n == bsum.ngroup)
+      hi = goal;
+    acquire(&bsum.lock);
+    nfree = bsum.gfree[gi];
+    release(&bsum.lock);
+    if(lo >= hi || nfree == 0)
+      continue;
+    if((b = bscan(dev, lo, hi, data)) != 0)
+      return b;
+  }
   printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Find n free blocks in a row, looking from goal onwards and
+// then wrapping around, without claiming them. Returns the
+// first of them, or, when there is no such run, the start of
+// the longest run seen; 0 if there are no free blocks at all.
+static uint
+brun(uint dev, uint n, uint goal)
+{
+  uint b, bi, i, start, len, best, bestlen;
+  struct buf *bp;
+
+  if(goal < bsum.dstart || goal >= sb.size)
+    goal = bsum.dstart;
+  start = len = best = bestlen = 0;
+  bp = 0;
+  for(i = 0; i < sb.size - bsum.dstart; i++){
+    b = goal + i;
+    if(b >= sb.size)
+      b -= sb.size - bsum.dstart;
+    if(b == bsum.dstart)
+      len = 0;   // wrapped around: no run continues from the end
+    if(bp == 0 || bp->blockno != BBLOCK(b, sb)){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, BBLOCK(b, sb));
+    }
+    bi = b % BPB;
+    if(bp->data[bi/8] & (1 << (bi % 8))){
+      len = 0;
+      continue;
+    }
+    if(len++ == 0)
+      start = b;
+    if(len > bestlen){
+      best = start;
+      bestlen = len;
+    }
+    if(len >= n)
+      break;
+  }
+  if(bp)
+    brelse(bp);
+  return best;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -162,6 +334,124 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&bsum.lock);
+  bsum.nfree++;
+  bsum.gfree[BGROUP(b)]++;
+  release(&bsum.lock);
+}
+
+// Inode map.
+
+// Build the map of allocated inodes and count the free ones.
+// Reads every inode block, but only once per mount.
+static void
+isuminit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  int inum;
+
+  if((sb.ninodes + 7) / 8 > PGSIZE)
+    panic("isuminit: too many inodes");
+  if((bsum.imap = kalloc()) == 0)
+    panic("isuminit: kalloc");
+  memset(bsum.imap, 0, PGSIZE);
+  bsum.ipg = (sb.ninodes + bsum.ngroup - 1) / bsum.ngroup;
+  bsum.imap[0] |= 1;  // inode 0 is never used
+  bp = 0;
+  for(inum = 1; inum < sb.ninodes; inum++){
+    if(bp == 0 || inum % IPB == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IBLOCK(inum, sb));
+    }
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type != 0){
+      bsum.imap[inum/8] |= 1 << (inum % 8);
+    } else {
+      bsum.nifree++;
+      bsum.gifree[IGROUP(inum)]++;
+    }
+  }
+  if(bp)
+    brelse(bp);
+}
+
+// Pick a free inode and mark it allocated in the map.
+// A new directory goes to a group with more than the average
+// number of free inodes and the most free blocks, so that
+// directories spread over the disk; anything else goes to
+// the group of its parent directory, to keep it close.
+// Returns 0 if there is no free inode.
+static uint
+imapalloc(short type, uint parent)
+{
+  uint g, gi, n, inum, hi, best;
+
+  acquire(&bsum.lock);
+  g = IGROUP(parent);
+  if(type == T_DIR){
+    best = 0;
+    for(gi = 0; gi < bsum.ngroup; gi++){
+      if(bsum.gifree[gi] * bsum.ngroup < bsum.nifree || bsum.gifree[gi] == 0)
+        continue;
+      if(bsum.gfree[gi] >= best){
+        best = bsum.gfree[gi];
+        g = gi;
+      }
+    }
+  }
+  for(n = 0; n < bsum.ngroup; n++){
+    gi = (g + n) % bsum.ngroup;
+    if(bsum.gifree[gi] == 0)
+      continue;
+    hi = min((gi + 1) * bsum.ipg, sb.ninodes);
+    for(inum = gi * bsum.ipg; inum < hi; inum++){
+      if((bsum.imap[inum/8] & (1 << (inum % 8))) == 0){
+        bsum.imap[inum/8] |= 1 << (inum % 8);
+        bsum.nifree--;
+        bsum.gifree[gi]--;
+        release(&bsum.lock);
+        return inum;
+      }
+    }
+  }
+  release(&bsum.lock);
+  return 0;
+}
+
+// Mark inode inum free in the map.
+static void
+imapfree(uint inum)
+{
+  acquire(&bsum.lock);
+  if((bsum.imap[inum/8] & (1 << (inum % 8))) == 0)
+    panic("freeing free inode");
+  bsum.imap[inum/8] &= ~(1 << (inum % 8));
+  bsum.nifree++;
+  bsum.gifree[IGROUP(inum)]++;
+  release(&bsum.lock);
+}
+
+// Report the file system's size and free space.
+void
+fsstat(uint dev, struct statfs *st)
+{
+  vfssw[dev]->statfs(dev, st);
+}
+
+static void
+diskstat(uint dev, struct statfs *st)
+{
+  acquire(&bsum.lock);
+  st->bsize = BSIZE;
+  st->blocks = sb.size;
+  st->bfree = bsum.nfree;
+  st->files = sb.ninodes;
+  st->ffree = bsum.nifree;
+  st->ngroup = bsum.ngroup;
+  st->flags = sb.flags;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -189,12 +479,14 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to a table entry (open files and
+//   current directories). iget() finds or creates a table
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref has fallen to zero stays in the table,
+//   still valid, on an LRU list, so that using the inode
+//   again need not read it from disk; it is recycled only
+//   when the table holds NINODE entries and needs another.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -224,10 +516,14 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is a hash table of entries allocated a page at a
+// time. Each hash bucket's lock protects its chain and the
+// ip->ref of the entries on it; one must hold the bucket lock
+// to use ip->ref, ip->dev or ip->inum. Changes that move an
+// entry on or off the LRU list, the free list or a chain (a ref
+// going from or to zero, or a new entry) also hold itable.lock,
+// acquired before any bucket lock, so that only one process at
+// a time ever holds two bucket locks.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -338,26 +634,160 @@ bfree(int dev, uint b)
 //   释放缓存和磁盘的 inode 及数据块
 //   哪怕最后一个访问文件的线程是只读文件
 //   它的 iput() 也会写磁盘上的 inode，使它的 inode->type = 0
+#define NIHASH 31
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;   // chain through ip->hnext
+};
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct ibucket bucket[NIHASH];
+  struct inode *free;   // never used or invalid entries, through ip->hnext
+  int n;                // entries allocated
+  uint *ifree;          // spare BSIZE copies for ip->ind, through their first word
+
+  // ref == 0 but valid entries, through prev/next.
+  // lru.next is most recently used, lru.prev is least.
+  struct inode lru;
 } itable;
 
+// Mount points. Each covers a directory mp, on some file system,
+// with the root directory of device dev; namex() crosses from
+// one to the other, both ways.
+struct mount {
+  struct inode *mp;     // covered directory, or 0; holds a reference
+  uint dev;             // device mounted there
+};
+
+struct {
+  struct spinlock lock;
+  struct mount m[NMOUNT];
+} mtab;
+
 void
 iinit()
 {
-  int i = 0;
+  int i;
   
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  for(i = 0; i < NIHASH; i++)
+    initlock(&itable.bucket[i].lock, "ibucket");
+  itable.lru.prev = &itable.lru;
+  itable.lru.next = &itable.lru;
+  initlock(&mtab.lock, "mtab");
+}
+
+// Find inode (dev, inum) on bucket b's chain. Caller holds b->lock.
+static struct inode*
+ifind(struct ibucket *b, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = b->head; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  }
+  return 0;
+}
+
+// Take ip off its bucket's chain. Caller holds the bucket lock.
+static void
+iunhash(struct ibucket *b, struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &b->head; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      return;
+    }
+  }
+  panic("iunhash");
+}
+
+static void
+lruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Find a table entry to hold a new inode: a free one, a new
+// one while the table has fewer than NINODE entries (or has no
+// unreferenced ones left to recycle), else the least recently
+// used unreferenced one. Caller holds itable.lock.
+static struct inode*
+islot(void)
+{
+  struct inode *ip;
+  struct ibucket *b;
+  char *pg;
+  int i;
+
+  if(itable.free == 0 && (itable.n < NINODE || itable.lru.prev == &itable.lru)){
+    if((pg = kalloc()) != 0){
+      for(i = 0; i + sizeof(*ip) <= PGSIZE; i += sizeof(*ip)){
+        ip = (struct inode*)(pg + i);
+        memset(ip, 0, sizeof(*ip));
+        initsleeplock(&ip->lock, "inode");
+        ip->hnext = itable.free;
+        itable.free = ip;
+        itable.n++;
+      }
+    }
+  }
+  if((ip = itable.free) != 0){
+    itable.free = ip->hnext;
+    return ip;
+  }
+  if((ip = itable.lru.prev) == &itable.lru)
+    return 0;
+  lruremove(ip);
+  b = &itable.bucket[IHASH(ip->dev, ip->inum)];
+  acquire(&b->lock);
+  iunhash(b, ip);
+  release(&b->lock);
+  if(ip->ind){
+    *(uint**)ip->ind = itable.ifree;
+    itable.ifree = ip->ind;
+    ip->ind = 0;
+  }
+  return ip;
+}
+
+// Space for ip->ind: BSIZE, not a page, so with small blocks
+// several inodes' copies share a kalloc()ed page. Pages are
+// cut up as needed, as islot() does for inodes, and kept.
+// Returns 0 if out of memory.
+static uint*
+indalloc(void)
+{
+  uint *a;
+  char *pg;
+  int i;
+
+  acquire(&itable.lock);
+  if(itable.ifree == 0 && (pg = kalloc()) != 0){
+    for(i = 0; i + BSIZE <= PGSIZE; i += BSIZE){
+      *(uint**)(pg + i) = itable.ifree;
+      itable.ifree = (uint*)(pg + i);
+    }
   }
+  if((a = itable.ifree) != 0)
+    itable.ifree = *(uint**)a;
+  release(&itable.lock);
+  return a;
 }
 
 static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
+// parent is the inode number of the directory that will
+// hold it, which steers where the inode is placed.
 // Returns an unlocked but allocated and referenced inode,
 // or NULL if there is no free inode.
 // 在 dev 上分配一个 dinode，标记它为已占用
@@ -375,14 +805,26 @@ static struct inode* iget(uint dev, uint inum);
 //
 // 分配完后，在 itable 中绑定一个表项，并返回该表项（inode 结构体）
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint parent)
+{
+  uint inum;
+
+  if((inum = vfssw[dev]->ialloc(dev, type, parent)) == 0)
+    return 0;
+  return iget(dev, inum);
+}
+
+// ialloc() for the disk file system: returns the inode number.
+static uint
+diskialloc(uint dev, short type, uint parent)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
- // ialloc can be sure that some other process does not simultaneously see that the
- // inode is available and try to claim it.
-  for(inum = 1; inum < sb.ninodes; inum++){
+
+  // 从内存中的 inode 位图挑选空闲的 inum, 不必逐块读取 inode 区域
+  // 位图在挑选时就被置位, 所以其他进程不会同时分配同一个 inode
+  if((inum = imapalloc(type, parent)) != 0){
     // 读取 inum 对应的磁盘中的 inode 所在的块
     // dinode 所在的块号 =（inode号）/（每块包含的dinode数） +（inode 区域的起始块号）
     bp = bread(dev, IBLOCK(inum, sb));
@@ -397,14 +839,15 @@ ialloc(uint dev, short type)
     // 那么 "+" 操作就可以将基址按 dinode 大小为单位增加。
     // 基址 +（dinode大小 * dinode 在其所属块中的序号）= dinode 在内存中的地址 
     dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
+    if(dip->type != 0)
+      panic("ialloc: inode map out of date");
+    memset(dip, 0, sizeof(*dip));
+    dip->type = type;
+    if((sb.flags & FS_EXTENTS) && type != T_DEVICE)
+      dip->flags = I_EXTENTS;
+    log_write(bp);   // mark it allocated on the disk
     brelse(bp);
+    return inum;
   }
   printf("ialloc: no inodes\n");
   return 0;
@@ -424,6 +867,12 @@ ialloc(uint dev, short type)
 // 所以文件系统的所有对块的修改，都只能先读取整个块，在整个块中只修改所需的部分，在以整个块写回磁盘
 void
 iupdate(struct inode *ip)
+{
+  ip->op->update(ip);
+}
+
+static void
+diskiupdate(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
@@ -436,6 +885,7 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->flags = ip->flags;
   // inode->addrs 是数据块号数组
   // 用 memmove 从 dinode 缓存的 dinode->addrs 连续写到 buf 的 dinode—>addrs
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
@@ -443,6 +893,7 @@ iupdate(struct inode *ip)
   log_write(bp);
   // 释放 inode 所在块的 buf
   brelse(bp);
+  ip->tid = log_tid();  // for fsync()
 }
 
 // Find the inode with number inum on device dev
@@ -464,40 +915,54 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct ibucket *b;
 
   // 避免同时写 inode->ref
-  acquire(&itable.lock);
+  // 常见情况: inode 已被引用, 只需持有所在哈希桶的锁
+  b = &itable.bucket[IHASH(dev, inum)];
+  acquire(&b->lock);
+  if((ip = ifind(b, dev, inum)) != 0 && ip->ref > 0){
+    ip->ref++;
+    release(&b->lock);
+    return ip;
+  }
+  release(&b->lock);
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  acquire(&itable.lock);
+  acquire(&b->lock);
+  // Is the inode already in the table, perhaps unreferenced?
+  if((ip = ifind(b, dev, inum)) != 0){
+    if(ip->ref == 0)
+      lruremove(ip);
+    ip->ref++;
+    release(&b->lock);
+    release(&itable.lock);
+    return ip;
   }
+  release(&b->lock);
 
   // Recycle an inode entry.
-  // 没在 itable 中找到 inum 对应的 inode，itable (inode 数组) 中没有空闲表项
-  if(empty == 0)
+  // 没在 itable 中找到 inum 对应的 inode，且既无法分配新表项，也没有未被引用的表项
+  if((ip = islot()) == 0)
     panic("iget: no inodes");
 
-  // 没在 itable 中找到 inum 对应的 inode，itable (inode 数组) 中存在空闲表项
-  // 就把该空闲表项和 inum 绑定，并设置仅在内存中使用的元数据
+  // 把该表项和 inum 绑定，并设置仅在内存中使用的元数据
   // 注意只是绑定表项和 inum
   // iget(inum) 不把磁盘中的 inum 对应的实际 inode 数据结构（对应内存的 dinode）加载到表项的 inode 中
   // iget(inum) 只是返回 inum 对应的表项，即 inode 结构体
   // 返回的 inode 结构体如果是刚被记录的，inode->dinode 就还没加载好 inum 的 dinode
   // 设置 inode->valid = 0
-  ip = empty;
+  // 只有持有 itable.lock 才能往哈希链上添加表项, 所以释放桶锁期间不会有别人添加同一个 inum
   ip->dev = dev;
   ip->inum = inum;
+  ip->op = vfssw[dev]->iops;
   ip->ref = 1;
   ip->valid = 0;
+  acquire(&b->lock);
+  ip->hnext = b->head;
+  b->head = ip;
+  release(&b->lock);
   release(&itable.lock);
 
   return ip;
@@ -509,9 +974,12 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *b;
+
+  b = &itable.bucket[IHASH(ip->dev, ip->inum)];
+  acquire(&b->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&b->lock);
   return ip;
 }
 
@@ -522,9 +990,6 @@ idup(struct inode *ip)
 void
 ilock(struct inode *ip)
 {
-  struct buf *bp;
-  struct dinode *dip;
-
   // iget(inum) 从 itable 获取 inode 时，inode->ref++
   // ilock(inode) 在 iput() inode->ref-- 之前调用
   // 所以调用约定逻辑如此，ilock(inode) 不应该出现 ref < 1；
@@ -543,21 +1008,37 @@ ilock(struct inode *ip)
   // inode 层的逻辑，应该只读取已经分配的 dinode
   // 如果读取到的 dinode 没被分配，dinode->type == 0, 就主动崩溃方便调试 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    brelse(bp);
+    ip->op->load(ip);
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
+// Read ip's dinode from the disk.
+static void
+diskiload(struct inode *ip)
+{
+  struct buf *bp;
+  struct dinode *dip;
+
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  ip->type = dip->type;
+  ip->major = dip->major;
+  ip->minor = dip->minor;
+  ip->nlink = dip->nlink;
+  ip->size = dip->size;
+  ip->flags = dip->flags;
+  memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+  ip->indaddr = 0;
+  ip->goal = 0;
+  // a transaction that is still open may have changed the
+  // inode before it left the cache; assume the worst.
+  ip->tid = ip->dtid = log_tid();
+  brelse(bp);
+}
+
 // Unlock the given inode.
 // 释放 inode->sleeplock
 void
@@ -626,7 +1107,20 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct ibucket *b;
+
+  // 不是最后一个引用: 只需持有所在哈希桶的锁
+  b = &itable.bucket[IHASH(ip->dev, ip->inum)];
+  acquire(&b->lock);
+  if(ip->ref > 1){
+    ip->ref--;
+    release(&b->lock);
+    return;
+  }
+  release(&b->lock);
+
   acquire(&itable.lock);
+  acquire(&b->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -635,11 +1129,14 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
+    release(&b->lock);
     release(&itable.lock);
 
     itrunc(ip); // 标记 inode 的所有数据块为未分配
     ip->type = 0; // 标记该 inode 未分配
     iupdate(ip); // 把 inode 的更新写回磁盘的 inode 区域
+    ip->op->free(ip);
+    dcpurge(ip->dev, ip->inum);
     // 因为该文件/目录 inode 被从磁盘中解除了分配
     // 意味着该 inum 的 inode 可以被重新分配给新文件
     // 那么缓存中该 inum 的老内容也应该被废弃
@@ -657,9 +1154,24 @@ iput(struct inode *ip)
     releasesleep(&ip->lock);
 
     acquire(&itable.lock);
+    acquire(&b->lock);
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    if(ip->valid){
+      // keep it, most recently used first.
+      ip->next = itable.lru.next;
+      ip->prev = &itable.lru;
+      itable.lru.next->prev = ip;
+      itable.lru.next = ip;
+    } else {
+      iunhash(b, ip);
+      ip->hnext = itable.free;
+      itable.free = ip;
+    }
+  }
+  release(&b->lock);
   release(&itable.lock);
 }
 
@@ -682,24 +1194,203 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NINDIRECT^2 after
+// those in the two-level tree of indirect blocks rooted at
+// ip->addrs[NDIRECT+1], and the NINDIRECT^3 after those in
+// the three-level tree rooted at ip->addrs[NDIRECT+2].
+//
+// ip->ind caches a copy of the bottom-level indirect block
+// bmap() used last, so walking a large file reads each
+// indirect block once rather than once per data block.
+//
+// An inode with I_EXTENTS set instead maps its content as
+// extents, runs of contiguous disk blocks. The first NIEXTENT
+// extents live in ip->addrs[] itself; ip->addrs[XBLOCK] names
+// an extent block holding up to NXEXTENT more. An extent with
+// len == 0 is an unused slot. Extents are not kept sorted.
+
+// Does ip keep its content out of the log in ordered mode?
+// Directory content is metadata and is always journaled.
+#define IDATA(ip) ((ip)->type == T_FILE)
+// and what its content is, for iostat.
+#define IORIGIN(ip) (IDATA(ip) ? IO_DATA : IO_META)
+
+// Where a block for ip goes when the caller has no better
+// hint: just after the last block allocated to it, or else
+// in the group its inode number maps to.
+static uint
+igoal(struct inode *ip)
+{
+  uint b;
+
+  if(ip->goal)
+    return ip->goal;
+  b = IGROUP(ip->inum) * bsum.bpg;
+  return b < bsum.dstart ? bsum.dstart : b;
+}
+
+// balloc() for inode ip, starting at goal (igoal(ip) if 0),
+// and move ip's allocation cursor past the new block.
+static uint
+iballoc(struct inode *ip, int data, uint goal)
+{
+  uint addr;
+
+  if((addr = balloc(ip->dev, data, goal ? goal : igoal(ip))) != 0)
+    ip->goal = addr + 1;
+  return addr;
+}
+
+// Return the extent among e[0..n-1] that maps logical block bn, or 0.
+static struct extent*
+efind(struct extent *e, int n, uint bn)
+{
+  for(int i = 0; i < n; i++){
+    if(e[i].len > 0 && bn >= e[i].lbn && bn - e[i].lbn < e[i].len)
+      return &e[i];
+  }
+  return 0;
+}
+
+// Return the extent among e[0..n-1] that ends just before
+// logical block bn (so could be extended to cover it), or 0.
+static struct extent*
+eprev(struct extent *e, int n, uint bn)
+{
+  for(int i = 0; i < n; i++){
+    if(e[i].len > 0 && e[i].lbn + e[i].len == bn)
+      return &e[i];
+  }
+  return 0;
+}
+
+// Return an unused slot among e[0..n-1], or 0.
+static struct extent*
+efree(struct extent *e, int n)
+{
+  for(int i = 0; i < n; i++){
+    if(e[i].len == 0)
+      return &e[i];
+  }
+  return 0;
+}
+
+// Look up logical block bn of extent-mapped inode ip.
+// Returns its disk block, or 0 if bn is not mapped, and sets
+// *run to the number of blocks from bn to the end of its extent.
+static uint
+emap(struct inode *ip, uint bn, uint *run)
+{
+  struct extent *e;
+  struct buf *bp;
+  uint addr;
+
+  if((e = efind((struct extent*)ip->addrs, NIEXTENT, bn)) != 0){
+    *run = e->len - (bn - e->lbn);
+    return e->pbn + (bn - e->lbn);
+  }
+  if(ip->addrs[XBLOCK] == 0)
+    return 0;
+  addr = 0;
+  bp = bread(ip->dev, ip->addrs[XBLOCK]);
+  if((e = efind((struct extent*)bp->data, NXEXTENT, bn)) != 0){
+    *run = e->len - (bn - e->lbn);
+    addr = e->pbn + (bn - e->lbn);
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Allocate a disk block for logical block bn of extent-mapped
+// inode ip, which must not be mapped yet. If an extent ends
+// at bn and the disk block after it is free, the extent just
+// grows by one; otherwise a new extent is started.
+// returns 0 if out of disk space or out of extent slots.
+static uint
+ealloc(struct inode *ip, uint bn)
+{
+  struct extent *e, *ie;
+  struct buf *bp;
+  uint addr, goal;
+
+  ie = (struct extent*)ip->addrs;
+  bp = 0;
+  if((e = eprev(ie, NIEXTENT, bn)) == 0 && ip->addrs[XBLOCK]){
+    bp = bread(ip->dev, ip->addrs[XBLOCK]);
+    if((e = eprev((struct extent*)bp->data, NXEXTENT, bn)) == 0){
+      brelse(bp);
+      bp = 0;
+    }
+  }
+
+  goal = e ? e->pbn + e->len : igoal(ip);
+  if((addr = iballoc(ip, IDATA(ip), goal)) == 0)
+    goto out;
+
+  if(e && addr == goal){
+    // contiguous: grow the extent in place.
+    e->len++;
+    if(bp)
+      log_write(bp);
+    goto out;
+  }
+  if(bp){
+    brelse(bp);
+    bp = 0;
+  }
+
+  // start a new extent, in the inode if there is room.
+  if((e = efree(ie, NIEXTENT)) == 0){
+    if(ip->addrs[XBLOCK] == 0){
+      if((ip->addrs[XBLOCK] = iballoc(ip, 0, addr + 1)) == 0){
+        bfree(ip->dev, addr);
+        return 0;
+      }
+    }
+    bp = bread(ip->dev, ip->addrs[XBLOCK]);
+    if((e = efree((struct extent*)bp->data, NXEXTENT)) == 0){
+      bfree(ip->dev, addr);
+      addr = 0;
+      goto out;
+    }
+  }
+  e->lbn = bn;
+  e->pbn = addr;
+  e->len = 1;
+  if(bp)
+    log_write(bp);
+
+out:
+  if(bp)
+    brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bwalk allocates one if alloc is
+// set, and otherwise returns 0: the block is a hole.
 // returns 0 if out of disk space.
 // 返回 inode 的第 bn 个数据块在整个磁盘(而不是数据块区域)的块地址
 // 用于通过 bread(dev, 对于整个磁盘的磁盘块号) 读取数据块内容
 // 如果第 bn 个数据块没有被分配磁盘块, 就分配一个磁盘块给第 bn 个数据块
 // 把新数据块地址写进 inode->addrs 或间接块的对应 uint 位置中, 再返回新分配的块地址
 static uint
-bmap(struct inode *ip, uint bn)
+bwalk(struct inode *ip, uint bn, int alloc)
 {
-  uint addr, *a;
+  uint addr, *a, run, lbn, idx;
+  uint64 span;
+  int level;
   struct buf *bp;
 
+  if(ip->flags & I_EXTENTS){
+    if((addr = emap(ip, bn, &run)) == 0 && alloc)
+      addr = ealloc(ip, bn);
+    return addr;
+  }
+
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0 && alloc){
+      addr = iballoc(ip, IDATA(ip), bn > 0 && ip->addrs[bn-1] ? ip->addrs[bn-1] + 1 : 0);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -708,44 +1399,172 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
+  // 最近使用的最底层间接块的副本: 命中时不用 bread 任何间接块
+  if(ip->indaddr && bn - ip->indlbn < NINDIRECT && ip->ind[bn - ip->indlbn])
+    return ip->ind[bn - ip->indlbn];
+
+  // Find the indirect tree holding bn: addrs[NDIRECT+level]
+  // is the root of level+1 levels of indirect blocks.
+  lbn = bn;
+  span = NINDIRECT;
+  for(level = 0; level < NLEVEL; level++){
+    if(lbn < span)
+      break;
+    lbn -= span;
+    span *= NINDIRECT;
+  }
+  if(level == NLEVEL)
+    panic("bmap: out of range");
+
+  // Load the root indirect block, allocating if necessary.
+  if((addr = ip->addrs[NDIRECT+level]) == 0){
+    if(!alloc)
+      return 0;
+    addr = iballoc(ip, 0, 0);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+level] = addr;
+  }
+
+  // 从根间接块逐层向下, 直到最底层间接块中第 bn 个数据块的地址
+  for(;;){
+    span /= NINDIRECT; // 当前间接块中每一项映射的块数
+    idx = lbn / span;
+    lbn %= span;
     bp = bread(ip->dev, addr); // 读取间接块
     a = (uint*)bp->data; // 间接块地址作为值，用 *uint 解释. 
     // 在间接块中索引指定的第 bn 个数据块号的数据块地址
-    if((addr = a[bn]) == 0){ // 将 a 的值解释为 *uint 来操作，表达式操作的结果值为 uint
-      // 如果第 bn 个数据块没有分配，就为他分配
-      addr = balloc(ip->dev);
+    if((addr = a[idx]) == 0 && alloc){ // 将 a 的值解释为 *uint 来操作，表达式操作的结果值为 uint
+      // 如果第 bn 个数据块（或下一层间接块）没有分配，就为他分配
+      if(span == 1)
+        addr = iballoc(ip, IDATA(ip), idx > 0 && a[idx-1] ? a[idx-1] + 1 : 0);
+      else
+        addr = iballoc(ip, 0, 0);
       if(addr){ // 分配成功，就写入间接块
-        a[bn] = addr;
+        a[idx] = addr;
         log_write(bp); // 将间接块的更新写入日志
       }
     }
+    if(span == 1 && addr){
+      // remember the leaf so the next blocks skip the walk.
+      if(ip->ind == 0)
+        ip->ind = indalloc();
+      if(ip->ind){
+        memmove(ip->ind, a, BSIZE);
+        ip->indaddr = bp->blockno;
+        ip->indlbn = bn - idx;
+      }
+    }
     brelse(bp);
-    return addr;
+    if(span == 1 || addr == 0)
+      return addr;
   }
+}
 
-  panic("bmap: out of range");
+// bwalk() that allocates: the nth block of ip always exists
+// afterwards, unless the disk is full.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  return bwalk(ip, bn, 1);
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-// 清空、释放文件所有数据块(文件内容)，设置 inode->size = 0
+// Like bwalk() without allocating, so 0 means a hole, but also
+// set *run to the number of blocks starting at bn known to be
+// contiguous on disk, so that callers walking a file need not
+// look up each of them.
+static uint
+bmaprun(struct inode *ip, uint bn, uint *run)
+{
+  uint addr, *a, i, lim;
+
+  *run = 1;
+  if(ip->flags & I_EXTENTS)
+    return emap(ip, bn, run);
+  if((addr = bwalk(ip, bn, 0)) == 0)
+    return 0;
+
+  // count the neighbours that bwalk() has at hand: the direct
+  // blocks, or the cached bottom-level indirect block.
+  if(bn < NDIRECT){
+    a = ip->addrs;
+    i = bn;
+    lim = NDIRECT;
+  } else if(ip->indaddr && bn - NDIRECT - ip->indlbn < NINDIRECT){
+    a = ip->ind;
+    i = bn - NDIRECT - ip->indlbn;
+    lim = NINDIRECT;
+  } else
+    return addr;
+  while(i + *run < lim && a[i + *run] == addr + *run)
+    (*run)++;
+  return addr;
+}
+
+// Free indirect block addr, which is level levels above
+// the data blocks, along with everything it points to.
+static void
+ifree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 0)
+      ifree(dev, a[j], level - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+// 清空、释放文件所有数据块(文件内容)，设置 inode->size = 0
 // 只是清空文件内容，文件(inode)本身仍保留
 // 假设持有 inode->sleeplock.
 // 要将更新的 inode 写回磁盘，用于写回磁盘的 iupdate() 也假设持有锁
 void
 itrunc(struct inode *ip)
+{
+  ip->op->trunc(ip);
+}
+
+static void
+diskitrunc(struct inode *ip)
 {
   int i, j;
   struct buf *bp;
-  uint *a;
+  struct extent *e;
+
+  if(ip->flags & I_EXTENTS){
+    e = (struct extent*)ip->addrs;
+    for(i = 0; i < NIEXTENT; i++){
+      for(j = 0; j < e[i].len; j++)
+        bfree(ip->dev, e[i].pbn + j);
+    }
+    if(ip->addrs[XBLOCK]){
+      bp = bread(ip->dev, ip->addrs[XBLOCK]);
+      e = (struct extent*)bp->data;
+      for(i = 0; i < NXEXTENT; i++){
+        for(j = 0; j < e[i].len; j++)
+          bfree(ip->dev, e[i].pbn + j);
+      }
+      brelse(bp);
+      bfree(ip->dev, ip->addrs[XBLOCK]);
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    ip->dtid = ip->tid;
+    return;
+  }
 
   // 解除 addrs 和数据块的绑定
   // 释放 addrs 中的所有数据块
@@ -759,21 +1578,84 @@ itrunc(struct inode *ip)
   // 如果有间接块，那么
   // 释放间接块中指向的所有数据块
   // 释放间接块本身
-  // 解除 addrs[NDIRECT] 和间接块的绑定 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  // 解除 addrs[NDIRECT+i] 和间接块的绑定 
+  for(i = 0; i < NLEVEL; i++){
+    if(ip->addrs[NDIRECT+i]){
+      ifree(ip->dev, ip->addrs[NDIRECT+i], i);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->indaddr = 0;
 
   ip->size = 0;
   iupdate(ip);
+  ip->dtid = ip->tid;
+}
+
+// Aim ip's next allocations at a free run of disk blocks long
+// enough for the unallocated blocks of bytes [off, off+n), so
+// that falloci() lays them out contiguously. Reads the bitmap
+// but changes nothing on disk, so needs no transaction.
+// Caller must hold ip->lock.
+void
+iplace(struct inode *ip, uint off, uint n)
+{
+  if(n > 0 && ip->op->place)
+    ip->op->place(ip, off, n);
+}
+
+static void
+diskiplace(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, run, need, b;
+
+  need = 0;
+  end = (off + n - 1) / BSIZE;
+  for(bn = off / BSIZE; bn <= end; bn++){
+    if(bmaprun(ip, bn, &run) == 0)
+      need++;
+  }
+  if(need > 0 && (b = brun(ip->dev, need, igoal(ip))) != 0)
+    ip->goal = b;
+}
+
+// Allocate (zeroed) the blocks of ip holding bytes [off, off+n)
+// that are not allocated yet, and grow ip to off+n if it is
+// shorter, as though those bytes had been written as zeros.
+// Caller must hold ip->lock and be in a transaction, and n must
+// be small enough for the blocks to fit in it, as for writei().
+// Returns 0, or -1 if out of disk space.
+int
+falloci(struct inode *ip, uint off, uint n)
+{
+  return ip->op->falloc(ip, off, n);
+}
+
+static int
+diskfalloc(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, run;
+  int r;
+
+  if(off + n < off)
+    return -1;
+  if(!(ip->flags & I_EXTENTS) && off + n > MAXFILE*BSIZE)
+    return -1;
+  r = 0;
+  if(n > 0){
+    end = (off + n - 1) / BSIZE;
+    for(bn = off / BSIZE; bn <= end; bn++){
+      if(bmaprun(ip, bn, &run) == 0 && bmap(ip, bn) == 0){
+        r = -1;
+        break;
+      }
+    }
+  }
+  if(r == 0 && off + n > ip->size)
+    ip->size = off + n;
+  iupdate(ip);
+  ip->dtid = ip->tid;
+  return r;
 }
 
 // Copy stat information from inode.
@@ -788,20 +1670,48 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
-// Read data from inode.
+// Move block bp into the user page at dst, which must be
+// page-aligned, by exchanging the page under dst with the
+// buffer's page (see bsteal()). The user page needs to be
+// writable, as it would for copyout().
+// Returns 0 on success, -1 if the block must be copied.
+static int
+bflip(struct buf *bp, uint64 dst)
+{
+  pte_t *pte;
+  uchar *pa;
+
+  if(dst >= MAXVA)
+    return -1;
+  pte = walk(myproc()->pagetable, dst, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return -1;
+  pa = (uchar*)PTE2PA(*pte);
+  if(bsteal(bp, &pa) < 0)
+    return -1;
+  *pte = PA2PTE(pa) | PTE_FLAGS(*pte);
+  return 0;
+}
+
+// Hand up to n bytes of ip's content from off to actor, a
+// piece at a time while the block holding the piece is locked:
+// actor(arg, bp, boff, m) is given the m bytes of bp->data
+// starting at boff and returns how many of them it used. Using
+// fewer stops the transfer; returning -1 fails it. Holes are
+// handed over as a block of zeros, and stay holes.
+// Returns the number of bytes used, or -1.
 // Caller must hold ip->lock.
-// If user_dst==1, then dst is a user virtual address;
-// otherwise, dst is a kernel address.
-// 读取文件（目录）数据块的指定位置（偏移量）的内容到指定地址
-// * dst: 读取到的起始地址
-// * user_dst：读取到的起始地址 dst 是否是用户地址. 若是，就在 c->proc->pagetable 拿到物理地址
-// * off: 被读取文件的字节偏移量（被读取文件相对文件所有内容的起始地址）
-// * n: 从偏移量 off 开始读取的字节数
-// 返回最后实际读取的字节数
 int
-readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+readi_actor(struct inode *ip, uint off, uint n, iactor actor, void *arg)
 {
-  uint tot, m;
+  return ip->op->read(ip, off, n, actor, arg);
+}
+
+static int
+diskread(struct inode *ip, uint off, uint n, iactor actor, void *arg)
+{
+  uint tot, m, addr, run;
+  int r;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -809,22 +1719,85 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
+  // run 是 addr 之后在磁盘上连续的已知块数, 在 run 之内不用重新 bmap
+  addr = run = 0;
+  for(tot=0; tot<n; tot+=r, off+=r){
+    if(run > 1){
+      addr++;
+      run--;
+    } else
+      addr = bmaprun(ip, off/BSIZE, &run);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if(addr == 0){
+      // 空洞: 读出全零, 不分配块
+      r = actor(arg, &zerobuf, off % BSIZE, m);
+    } else {
+      // the rest of the run is contiguous: read it ahead.
+      bp = breadn(ip->dev, addr, run, IORIGIN(ip));
+      r = actor(arg, bp, off % BSIZE, m);
       brelse(bp);
-      tot = -1;
+    }
+    if(r < 0)
+      return -1;
+    if(r < m){
+      tot += r;
       break;
     }
-    brelse(bp);
   }
   return tot;
 }
 
+// Where readi() and writei() copy to or from.
+struct icopy {
+  int user;             // addr is a user virtual address?
+  uint64 addr;
+};
+
+static int
+copyout_actor(void *arg, struct buf *bp, uint boff, uint m)
+{
+  struct icopy *c = arg;
+
+  // 整页对齐地读整页的块: 与用户页交换物理页, 不复制数据
+  if(c->user && m == PGSIZE && c->addr % PGSIZE == 0 && bflip(bp, c->addr) == 0){
+    c->addr += m;
+    return m;
+  }
+  if(either_copyout(c->user, c->addr, bp->data + boff, m) == -1)
+    return -1;
+  c->addr += m;
+  return m;
+}
+
+static int
+copyin_actor(void *arg, struct buf *bp, uint boff, uint m)
+{
+  struct icopy *c = arg;
+
+  if(either_copyin(bp->data + boff, c->user, c->addr, m) == -1)
+    return -1;
+  c->addr += m;
+  return m;
+}
+
+// Read data from inode.
+// Caller must hold ip->lock.
+// If user_dst==1, then dst is a user virtual address;
+// otherwise, dst is a kernel address.
+// 读取文件（目录）数据块的指定位置（偏移量）的内容到指定地址
+// * dst: 读取到的起始地址
+// * user_dst：读取到的起始地址 dst 是否是用户地址. 若是，就在 c->proc->pagetable 拿到物理地址
+// * off: 被读取文件的字节偏移量（被读取文件相对文件所有内容的起始地址）
+// * n: 从偏移量 off 开始读取的字节数
+// 返回最后实际读取的字节数
+int
+readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  struct icopy c = { user_dst, dst };
+
+  return readi_actor(ip, off, n, copyout_actor, &c);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -844,16 +1817,40 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // readi，writei 都要指定在文件内开始读写的位置 off
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  struct icopy c = { user_src, src };
+
+  return writei_actor(ip, off, n, copyin_actor, &c);
+}
+
+// Like readi_actor(), but for writing: actor fills in the
+// pieces of ip's content, allocating blocks as needed, and
+// ip grows to cover what it wrote.
+// Returns the number of bytes written, or -1.
+// Caller must hold ip->lock and be in a transaction.
+int
+writei_actor(struct inode *ip, uint off, uint n, iactor actor, void *arg)
+{
+  return ip->op->write(ip, off, n, actor, arg);
+}
+
+static int
+diskwrite(struct inode *ip, uint off, uint n, iactor actor, void *arg)
 {
   uint tot, m;
+  int r;
   struct buf *bp;
 
-  if(off > ip->size || off + n < off)
+  // writing past the end leaves a hole between the old end
+  // and off, which reads as zeros and takes no blocks.
+  if(off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  // extent-mapped files are limited only by free extent slots,
+  // which bmap() reports as running out of space.
+  if(!(ip->flags & I_EXTENTS) && off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+  for(tot=0; tot<n; tot+=r, off+=r){
     // bmap() 会为未分配磁盘块的第 n 个数据块分配一个磁盘块
     // 并把块地址写进 inode->addrs 或 inode->addrs[INDIRECT] (间接块) 的对应位置
     // 并返回这个新的数据块的块地址
@@ -861,9 +1858,9 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     uint addr = bmap(ip, off/BSIZE); // 更新 bitsmap 缓存块；更新 inode 缓存表项
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr); // 更新 inode 数据块的缓存块
+    bp = breadn(ip->dev, addr, 1, IORIGIN(ip)); // 更新 inode 数据块的缓存块
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+    if((r = actor(arg, bp, off % BSIZE, m)) <= 0){
       brelse(bp);
       break;
     }
@@ -878,11 +1875,21 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     // * 写入磁盘之后，再次访问时
     //   要么还在缓存，属于前两种情况。
     //   要么从磁盘拉取新内容，保证访问的是最新内容。
-    log_write(bp); // 在释放前，用 log_write 把块缓存 pin（固定） 在了缓存
+    // 在释放前，用 log_write 把块缓存 pin（固定） 在了缓存
+    // 文件数据在 ordered 模式下不写日志, 由 commit 直接写回原位置
+    if(IDATA(ip))
+      log_write_data(bp);
+    else
+      log_write(bp);
     brelse(bp); // 可以放心释放更新过的块，而不用担心更新由于块缓存替换而丢失
+    if(r < m){
+      tot += r;
+      off += r;
+      break;
+    }
   }
 
-  if(off > ip->size)
+  if(tot > 0 && off > ip->size)
     ip->size = off;
 
   // write the i-node back to disk even if the size didn't change
@@ -895,10 +1902,41 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   // 但是，块缓存也是缓存，也有担心被替换而丢失更新的问题
   // 但这是块缓存的问题，block Cache 对快缓存更新被丢失的解决方法见上（brelse() 前的相关问题）
   iupdate(ip);
+  ip->dtid = ip->tid;
 
   return tot;
 }
 
+static void
+diskifree(struct inode *ip)
+{
+  imapfree(ip->inum);
+}
+
+static struct inode* diskdirlookup(struct inode*, char*, uint*);
+static int disklink(struct inode*, char*, uint);
+
+static struct iops diskiops = {
+  .load = diskiload,
+  .update = diskiupdate,
+  .free = diskifree,
+  .trunc = diskitrunc,
+  .place = diskiplace,
+  .falloc = diskfalloc,
+  .read = diskread,
+  .write = diskwrite,
+  .lookup = diskdirlookup,
+  .link = disklink,
+  .unlink = direrase,
+};
+
+static struct vfsops diskops = {
+  .name = "xv6fs",
+  .ialloc = diskialloc,
+  .statfs = diskstat,
+  .iops = &diskiops,
+};
+
 // Directories
 
 int
@@ -907,8 +1945,365 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directory index (see struct dxhead in fs.h).
+
+#define NDIRENT (BSIZE / sizeof(struct dirent))
+
+// The path dxlookup() took from the root to a leaf.
+struct dxpath {
+  uint leaf;            // logical block of the leaf
+  int nlevel;           // index blocks on the path, root included
+  uint blk[2];          // logical block of each; blk[0] is the root, 0
+  int at[2];            // entry followed in each
+};
+
+// FNV-1a hash of a directory entry name.
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// The header of index block bp. The root is block 0,
+// whose first two slots hold "." and "..".
+static struct dxhead*
+dxnode(struct buf *bp, int root)
+{
+  return (struct dxhead*)bp->data + (root ? 2 : 0);
+}
+
+#define DXENT(hd) ((struct dxentry*)((hd) + 1))
+
+// Read logical block blk of directory dp, which must exist.
+static struct buf*
+dxread(struct inode *dp, uint blk)
+{
+  uint addr;
+
+  if((addr = bmap(dp, blk)) == 0)
+    panic("dxread");
+  return bread(dp->dev, addr);
+}
+
+// Append an empty block to directory dp.
+// Returns its logical block number, or -1.
+static int
+dxgrow(struct inode *dp)
+{
+  uint blk;
+
+  blk = dp->size / BSIZE;
+  if(bmap(dp, blk) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return blk;
+}
+
+// Index of the entry among e[0..n-1] covering hash h:
+// the last one whose hash is not above h, or 0.
+static int
+dxsearch(struct dxentry *e, int n, uint h)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(e[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Insert (h, blk) just after entry at of index block hd,
+// which must have room.
+static void
+dxput(struct dxhead *hd, int at, uint h, uint blk)
+{
+  struct dxentry *e;
+
+  e = DXENT(hd);
+  memmove(e + at + 2, e + at + 1, (hd->count - at - 1) * sizeof(*e));
+  memset(&e[at+1], 0, sizeof(*e));
+  e[at+1].hash = h;
+  e[at+1].block = blk;
+  hd->count++;
+}
+
+// Walk the index of dp down to the leaf for hash h.
+static void
+dxlookup(struct inode *dp, uint h, struct dxpath *p)
+{
+  struct buf *bp;
+  struct dxhead *hd;
+  struct dxentry *e;
+  uint blk;
+  int levels;
+
+  blk = 0;
+  levels = 0;
+  for(p->nlevel = 0; ; p->nlevel++){
+    bp = dxread(dp, blk);
+    hd = dxnode(bp, p->nlevel == 0);
+    if(p->nlevel == 0)
+      levels = hd->levels;
+    e = DXENT(hd);
+    p->blk[p->nlevel] = blk;
+    p->at[p->nlevel] = dxsearch(e, hd->count, h);
+    blk = e[p->at[p->nlevel]].block;
+    brelse(bp);
+    if(p->nlevel == levels)
+      break;
+  }
+  p->nlevel++;
+  p->leaf = blk;
+}
+
+// Name leaf blk, holding hashes from h up, in the index
+// block above the leaf p leads to, just after that leaf.
+// A full root of leaves moves its entries down into a new
+// index block; a full index block is split in two.
+// Returns -1 if the index can grow no further.
+static int
+dxinsert(struct inode *dp, struct dxpath *p, uint h, uint blk)
+{
+  struct buf *bp, *nbp, *rbp;
+  struct dxhead *hd, *nhd, *rhd;
+  struct dxentry *e;
+  int lvl, at, m, nblk;
+
+  lvl = p->nlevel - 1;
+  at = p->at[lvl];
+  bp = dxread(dp, p->blk[lvl]);
+  hd = dxnode(bp, lvl == 0);
+  e = DXENT(hd);
+  if(hd->count == hd->limit && lvl == 0){
+    // root full of leaves: one more level.
+    if((nblk = dxgrow(dp)) < 0){
+      brelse(bp);
+      return -1;
+    }
+    nbp = dxread(dp, nblk);
+    nhd = dxnode(nbp, 0);
+    nhd->count = hd->count;
+    nhd->limit = DXLIMIT(0);
+    memmove(DXENT(nhd), e, hd->count * sizeof(*e));
+    memset(e, 0, hd->count * sizeof(*e));
+    hd->levels = 1;
+    hd->count = 1;
+    e[0].block = nblk;
+    log_write(bp);
+    brelse(bp);
+    bp = nbp;
+    hd = nhd;
+  } else if(hd->count == hd->limit){
+    // index block full: move its upper half to a new one.
+    rbp = dxread(dp, p->blk[0]);
+    rhd = dxnode(rbp, 1);
+    if(rhd->count == rhd->limit || (nblk = dxgrow(dp)) < 0){
+      printf("dirlink: directory index full\n");
+      brelse(rbp);
+      brelse(bp);
+      return -1;
+    }
+    nbp = dxread(dp, nblk);
+    nhd = dxnode(nbp, 0);
+    m = hd->count / 2;
+    nhd->count = hd->count - m;
+    nhd->limit = DXLIMIT(0);
+    memmove(DXENT(nhd), e + m, nhd->count * sizeof(*e));
+    dxput(rhd, p->at[0], e[m].hash, nblk);
+    memset(e + m, 0, nhd->count * sizeof(*e));
+    hd->count = m;
+    log_write(rbp);
+    brelse(rbp);
+    if(at >= m){
+      log_write(bp);
+      brelse(bp);
+      bp = nbp;
+      hd = nhd;
+      at -= m;
+    } else {
+      log_write(nbp);
+      brelse(nbp);
+    }
+  }
+  dxput(hd, at, h, blk);
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Split the full leaf p leads to, moving the entries with
+// the upper half of its hashes to a new leaf. Entries with
+// equal hashes stay together, so a lookup reads one leaf.
+static int
+dxsplit(struct inode *dp, struct dxpath *p)
+{
+  struct dxsort {
+    uint hash;
+    uint slot;          // index of the dirent in the leaf
+  } *t, x;
+  struct buf *bp, *nbp;
+  struct dirent *de;
+  int i, j, n, m, nblk, r;
+
+  if((t = kalloc()) == 0)
+    return -1;
+  bp = dxread(dp, p->leaf);
+  de = (struct dirent*)bp->data;
+  // 按 hash 插入排序
+  n = 0;
+  for(i = 0; i < NDIRENT; i++){
+    if(de[i].inum == 0)
+      continue;
+    x.hash = dxhash(de[i].name);
+    x.slot = i;
+    for(j = n++; j > 0 && t[j-1].hash > x.hash; j--)
+      t[j] = t[j-1];
+    t[j] = x;
+  }
+
+  // split near the middle, between two different hashes.
+  for(m = n / 2; m < n && t[m].hash == t[m-1].hash; m++)
+    ;
+  if(m == n)
+    for(m = n / 2; m > 0 && t[m].hash == t[m-1].hash; m--)
+      ;
+
+  r = -1;
+  if(m > 0 && (nblk = dxgrow(dp)) >= 0 && dxinsert(dp, p, t[m].hash, nblk) == 0){
+    // the upper half moves; its slots in the old leaf are left empty.
+    nbp = dxread(dp, nblk);
+    for(i = m; i < n; i++){
+      ((struct dirent*)nbp->data)[i - m] = de[t[i].slot];
+      memset(&de[t[i].slot], 0, sizeof(*de));
+    }
+    log_write(nbp);
+    brelse(nbp);
+    log_write(bp);
+    dcpurge(dp->dev, dp->inum);  // entries moved
+    r = 0;
+  }
+  brelse(bp);
+  kfree(t);
+  return r;
+}
+
+// Turn directory dp, whose one block is full, into an
+// index: its entries other than "." and ".." move to a new
+// leaf, and the rest of block 0 becomes the index root.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *bp, *nbp;
+  struct dxhead *hd;
+  int blk;
+
+  if((blk = dxgrow(dp)) < 0)
+    return -1;
+  bp = dxread(dp, 0);
+  nbp = dxread(dp, blk);
+  memmove(nbp->data + 2*sizeof(struct dirent), bp->data + 2*sizeof(struct dirent),
+          BSIZE - 2*sizeof(struct dirent));
+  log_write(nbp);
+  brelse(nbp);
+  memset(bp->data + 2*sizeof(struct dirent), 0, BSIZE - 2*sizeof(struct dirent));
+  hd = dxnode(bp, 1);
+  hd->levels = 0;
+  hd->count = 1;
+  hd->limit = DXLIMIT(1);
+  DXENT(hd)[0].block = blk;
+  log_write(bp);
+  brelse(bp);
+  dp->flags |= I_DIRINDEX;
+  iupdate(dp);
+  dcpurge(dp->dev, dp->inum);  // entries moved
+  return 0;
+}
+
+// dirlookup() for an I_DIRINDEX directory: read only the
+// leaf the index gives for name.
+static struct inode*
+dxfind(struct inode *dp, char *name, uint *poff)
+{
+  struct dxpath p;
+  struct buf *bp;
+  struct dirent *de;
+  uint inum, off;
+  int i;
+
+  dxlookup(dp, dxhash(name), &p);
+  bp = dxread(dp, p.leaf);
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < NDIRENT; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      off = p.leaf * BSIZE + i * sizeof(*de);
+      if(poff)
+        *poff = off;
+      inum = de[i].inum;
+      brelse(bp);
+      dcenter(dp, name, inum, off);
+      return iget(dp->dev, inum);
+    }
+  }
+  brelse(bp);
+  dcenter(dp, name, 0, 0);
+  return 0;
+}
+
+// dirlink() for an I_DIRINDEX directory: put the entry in
+// the leaf for its hash, splitting the leaf if it is full.
+// A split writes up to eight blocks (two leaves, two index
+// blocks, the root, the bitmap, an indirect block and dp's
+// inode), so an operation may split only once to stay in its
+// MAXOPBLOCKS; if the leaf for name is still full after that,
+// fail.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct dxpath p;
+  struct buf *bp;
+  struct dirent *de;
+  int i, split;
+
+  for(split = 0; ; split++){
+    dxlookup(dp, dxhash(name), &p);
+    bp = dxread(dp, p.leaf);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < NDIRENT; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        dcenter(dp, name, inum, p.leaf * BSIZE + i * sizeof(*de));
+        return 0;
+      }
+    }
+    brelse(bp);
+    if(split > 0 || dxsplit(dp, &p) < 0)
+      return -1;
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Consults the directory entry cache first, then the file
+// system's lookup operation, which records what it finds
+// there, found or not.
 // 检查目录中是否存在该目录项 （name，inum）
 // 如果有，就为该 inum 预定一个 inode 表项，并返回该表项. 即 iget(inum)
 // caller 必须持有目录 dp 的锁 dp->sleeplock
@@ -916,11 +2311,28 @@ struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dclookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  return dp->op->lookup(dp, name, poff);
+}
+
+// The lookup operation of a directory that is a plain list
+// of dirents: read them all until name turns up.
+struct inode*
+dirscan(struct inode *dp, char *name, uint *poff)
+{
+  uint off, inum;
+  struct dirent de;
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -931,6 +2343,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp, name, inum, off);
       // 要访问的 inode 可能同时在多个目录被引用. 会产生导致死锁的可能
       // 假设有两个目录项 (/usr/f.c, inum1), (/root/f.c, inum1). inum1 对应 inode1
       // 假设 iget() 返回的 inode 持有锁
@@ -955,6 +2368,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
     }
   }
 
+  dcenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -963,8 +2377,6 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
   struct inode *ip;
 
   // Check that name is not present.
@@ -972,22 +2384,39 @@ dirlink(struct inode *dp, char *name, uint inum)
     iput(ip);
     return -1;
   }
+  return dp->op->link(dp, name, inum);
+}
+
+// Offset of the first empty dirent in dp, or dp->size if none.
+static uint
+dirslot(struct inode *dp)
+{
+  uint off;
+  struct dirent de;
 
-  // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
       break;
   }
+  return off;
+}
+
+// Put entry (name, inum) at offset off of dp.
+static int
+dirput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dirent de;
 
+  memset(&de, 0, sizeof(de));
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
 
   // 把目录结构体写进目录 inode 数据区域（包含所有数据块）的指定偏移量位置
   // writei() 利用 bmap() 自动扩展文件大小
   // 如果目录的当前占用的所有数据块都已经被目录项占满
-  // 上面的的 loop 就会使 off 停在大于等于 dp->size 的位置
+  // dirslot() 的 loop 就会使 off 停在大于等于 dp->size 的位置
   // 这个位置就是新目录项的理想偏移位置
   // writei 会扩展数据块, 可以在新的数据块内, 从偏移位置 off 开始写新的目录项
   // 
@@ -996,10 +2425,161 @@ dirlink(struct inode *dp, char *name, uint inum)
   // 说明目录 inode, 即目录文件（内容）大小已经达到最大文件大小, 无法再写入了
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcenter(dp, name, inum, off);
+
+  return 0;
+}
+
+// The link operation of a plain list of dirents: the first
+// empty one, or a new one at the end.
+int
+dirappend(struct inode *dp, char *name, uint inum)
+{
+  return dirput(dp, name, inum, dirslot(dp));
+}
+
+// Remove the entry for name, which dirlookup() found at off.
+int
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  return dp->op->unlink(dp, name, off);
+}
+
+// The unlink operation of a plain list of dirents, and of an
+// indexed directory's leaves: clear the dirent.
+int
+direrase(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    return -1;
+  dcenter(dp, name, 0, 0);
+  return 0;
+}
+
+// The lookup operation of the disk file system: through the
+// index for an I_DIRINDEX directory. "." and ".." are always
+// the first two entries of block 0.
+static struct inode*
+diskdirlookup(struct inode *dp, char *name, uint *poff)
+{
+  if((dp->flags & I_DIRINDEX) && namecmp(name, ".") != 0 && namecmp(name, "..") != 0)
+    return dxfind(dp, name, poff);
+  return dirscan(dp, name, poff);
+}
+
+// The link operation of the disk file system.
+static int
+disklink(struct inode *dp, char *name, uint inum)
+{
+  uint off;
+
+  if(dp->flags & I_DIRINDEX)
+    return dxlink(dp, name, inum);
+  off = dirslot(dp);
+  // 单块的线性目录已满: 在支持索引的文件系统上转换为哈希索引目录
+  if(off == BSIZE && dp->size == BSIZE &&
+     (sb.flags & FS_DIRINDEX) && dxconvert(dp) == 0)
+    return dxlink(dp, name, inum);
+  return dirput(dp, name, inum, off);
+}
+
+// Mount points
 
+// Cover directory mp with the root of the file system of type
+// fstype, taking over the caller's reference to mp. Returns 0,
+// or -1 if there is no such file system other than the root,
+// it is already mounted, mp already covered, or the table is full.
+int
+fsmount(struct inode *mp, char *fstype)
+{
+  struct mount *m, *slot;
+  uint dev;
+
+  for(dev = 0; dev < NFSDEV; dev++){
+    if(dev != ROOTDEV && vfssw[dev] && strncmp(vfssw[dev]->name, fstype, MAXPATH) == 0)
+      break;
+  }
+  if(dev == NFSDEV)
+    return -1;
+  slot = 0;
+  acquire(&mtab.lock);
+  for(m = mtab.m; m < &mtab.m[NMOUNT]; m++){
+    if(m->mp == 0){
+      if(slot == 0)
+        slot = m;
+    } else if(m->dev == dev || m->mp == mp){
+      slot = 0;
+      break;
+    }
+  }
+  if(slot == 0){
+    release(&mtab.lock);
+    return -1;
+  }
+  slot->mp = mp;
+  slot->dev = dev;
+  release(&mtab.lock);
   return 0;
 }
 
+// Is ip covered by a mount?
+int
+mntpoint(struct inode *ip)
+{
+  struct mount *m;
+  int r = 0;
+
+  acquire(&mtab.lock);
+  for(m = mtab.m; m < &mtab.m[NMOUNT]; m++){
+    if(m->mp == ip)
+      r = 1;
+  }
+  release(&mtab.lock);
+  return r;
+}
+
+// If ip is covered by a mount, trade the reference to it for
+// one to the root of what is mounted there.
+static struct inode*
+mntin(struct inode *ip)
+{
+  struct mount *m;
+  uint dev = 0;
+
+  acquire(&mtab.lock);
+  for(m = mtab.m; m < &mtab.m[NMOUNT]; m++){
+    if(m->mp == ip)
+      dev = m->dev;
+  }
+  release(&mtab.lock);
+  if(dev == 0)
+    return ip;
+  iput(ip);
+  return iget(dev, ROOTINO);
+}
+
+// If ip is the root of a mounted file system, return a new
+// reference to the directory it covers; otherwise 0.
+static struct inode*
+mntout(struct inode *ip)
+{
+  struct mount *m;
+  struct inode *mp = 0;
+
+  if(ip->inum != ROOTINO)
+    return 0;
+  acquire(&mtab.lock);
+  for(m = mtab.m; m < &mtab.m[NMOUNT]; m++){
+    if(m->mp && m->dev == ip->dev)
+      mp = m->mp;
+  }
+  release(&mtab.lock);
+  return mp ? idup(mp) : 0;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -1106,6 +2686,13 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
+    // ".." at the root of a mounted file system leaves it
+    // through the directory it covers.
+    if(namecmp(name, "..") == 0 && (next = mntout(ip)) != 0){
+      iunlockput(ip);
+      ip = next;
+      ilock(ip);
+    }
     // 在遍历的当前目录下，寻找下一个目录的 inode
     // 例如 path == "/usr/a/b/c"
     // 第一次循环内
@@ -1140,7 +2727,7 @@ namex(char *path, int nameiparent, char *name)
     //    确保该inum的inode不会被替换成其他文件的内容后
     //    再释放锁，减少引用计数
     iunlockput(ip);
-    ip = next; // 更新当前目录
+    ip = mntin(next); // 更新当前目录, 进入挂载在该目录上的文件系统
   }
   // 退出循环后，ip 是末目录/文件的 inode
   
@@ -3,12 +3,24 @@
 
 
 #define ROOTINO  1   // root i-number
+
+// The block size is fixed when the kernel, user programs and
+// mkfs are built (make FSBSIZE=4096); mkfs records it in the
+// superblock and the kernel will not mount a file system made
+// with another.
+#ifndef BSIZE
 #define BSIZE 1024  // block size
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
 //
+// The super block is at byte offset SBOFF, so that it can be
+// read without knowing the block size: block 1 when BSIZE is
+// 1024, inside the boot block when blocks are larger.
+#define SBOFF 1024
+//
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
 struct superblock {
@@ -20,13 +32,28 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint flags;        // FS_* feature flags
+  uint bsize;        // Block size (BSIZE of the mkfs that made it)
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// Superblock flags, chosen by mkfs.
+// MNTFLAGS in param.h can force them on at mount time.
+#define FS_ORDERED 0x1   // journal only metadata; file data is written in place
+#define FS_EXTENTS 0x2   // new files and directories are mapped by extents
+#define FS_DIRINDEX 0x4  // directories outgrowing one block get a hash index
+#define FS_ASYNC 0x8     // commit the log lazily; fsync() forces it (see log.c)
+
+#define NDIRECT 9
+#define NLEVEL 3        // single, double and triple indirect
+#define NADDRS (NDIRECT+NLEVEL)
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NINDIRECT*NINDIRECT + NINDIRECT*NINDIRECT*NINDIRECT)
+
+// Inode flags
+#define I_EXTENTS 0x1   // addrs[] holds extents, not block numbers
+#define I_DIRINDEX 0x2  // directory content is a hash index (see below)
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +62,25 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // I_* flags
+  uint addrs[NADDRS];   // Data block addresses
+};
+
+// A run of len contiguous disk blocks starting at pbn,
+// holding the file's blocks starting at logical block lbn.
+struct extent {
+  uint lbn;
+  uint pbn;
+  uint len;             // 0 means unused
 };
 
+// An I_EXTENTS inode keeps NIEXTENT extents in its addrs[]
+// and the block number of an extent block, holding NXEXTENT
+// more, in addrs[XBLOCK].
+#define NIEXTENT 3
+#define NXEXTENT (BSIZE / sizeof(struct extent))
+#define XBLOCK (NADDRS-1)
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -58,3 +101,32 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// An I_DIRINDEX directory keeps its entries in leaf blocks,
+// each an ordinary array of dirents, and finds the leaf for a
+// name by its hash. Block 0 holds ".", "..", then the root of
+// the index: a dxhead followed by dxentry slots. If the root's
+// levels is 1 its entries name index blocks, each a dxhead and
+// dxentry slots, which in turn name leaves. Every slot is the
+// size of a dirent and starts with a zero inum, so a program
+// reading the directory as plain dirents skips the index.
+struct dxhead {
+  ushort zero;
+  ushort levels;        // root only: index blocks below the root
+  ushort count;         // dxentry slots in use
+  ushort limit;         // dxentry slots in the block
+  uint unused[2];
+};
+
+// Entries are sorted by hash. Entry i names the block for
+// hashes from its hash up to entry i+1's; entry 0's hash
+// covers everything below, too.
+struct dxentry {
+  ushort zero;
+  ushort unused;
+  uint hash;
+  uint block;           // logical block number in the directory
+  uint unused2;
+};
+
+#define DXLIMIT(root) (BSIZE / sizeof(struct dxentry) - ((root) ? 3 : 1))
+
@@ -0,0 +1,13 @@
+// I/O priority classes, for ioprio(). A class's disk requests
+// go ahead of all those of the classes after it.
+#define IOPRIO_RT    0  // real time: always first
+#define IOPRIO_BE    1  // best effort: the default
+#define IOPRIO_IDLE  2  // only when the disk is otherwise idle
+#define NIOPRIO      3
+
+// Completion polling modes, for iopoll(). A process waiting for a
+// polled request spins on the disk for a short while before it
+// sleeps, saving the interrupt and wakeup when the disk is fast.
+#define IOPOLL_NEVER    0  // always wait for the interrupt
+#define IOPOLL_FLAGGED  1  // poll for requests marked BIO_POLL (default)
+#define IOPOLL_ALL      2  // poll for every request
@@ -0,0 +1,30 @@
+#include "ioprio.h"
+
+// What a disk block holds, for iostat().
+#define IO_META  0  // inodes, bitmaps, directories, indirect blocks
+#define IO_LOG   1  // the log's header and copies
+#define IO_DATA  2  // file contents
+#define NIOORIGIN 3
+
+#define NIOHIST  16 // latency buckets: [2^i, 2^(i+1)) microseconds
+
+// Block I/O counters for one device, returned by iostat().
+// Latencies run from submission to completion, queueing in
+// the I/O scheduler included.
+struct iostat {
+  uint reads;                     // requests completed
+  uint writes;
+  uint rsectors;                  // 512-byte sectors moved
+  uint wsectors;
+  uint merges;                    // requests sent inside another's
+  uint queued;                    // requests in the scheduler now
+  uint inflight;                  // requests at the driver now
+  uint64 busy;                    // microseconds with requests at the driver
+  uint origin[NIOORIGIN];         // requests by origin
+  uint hist[NIOORIGIN][NIOHIST];  // latencies by origin
+  uint intrhist[NIOHIST];         // latencies of interrupt completions
+  uint pollhist[NIOHIST];         // latencies of polled completions
+  uint prio[NIOPRIO];             // requests by I/O priority class
+  uint priotime[NIOPRIO];         // their total latency in microseconds
+  uint priomax[NIOPRIO];          // and longest latency
+};
@@ -4,8 +4,10 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -28,7 +30,30 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous. A commit writes the logged blocks
+// to the log, and later to their home locations, in multi-block
+// disk requests rather than one request per block.
+//
+// In ordered mode (FS_ORDERED) only metadata goes through the
+// log. File data blocks handed to log_write_data() are pinned
+// like logged blocks, but commit() writes them straight to their
+// home locations before the log header that makes the metadata
+// pointing at them durable, so bulk data is written once
+// instead of twice and does not take up room in the on-disk log.
+//
+// With FS_ASYNC, end_op() does not commit just because the last
+// outstanding operation finished: operations keep joining the
+// open transaction until the log fills up or someone calls
+// log_force(), as fsync() does, or the open transaction has
+// been open for COMMIT_TICKS; the syncer process started by
+// initlog() commits it then if no end_op() does first. A crash
+// loses at most that much, and the file system stays consistent.
+// Transactions are numbered; log_tid() names the open one.
+// The batching is bounded by the log: a transaction commits
+// once it might not fit another two operations, so LOGSIZE
+// leaves room for LOGSIZE-2*MAXOPBLOCKS distinct blocks (forty)
+// between commits, however often each is rewritten. NBUF is
+// sized so the pinned blocks still leave buffers to read with.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -44,12 +69,23 @@ struct log {
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
   int dev;
+  int ordered;     // FS_ORDERED: file data bypasses the log
+  int nordered;    // # of data blocks to write home before commit
+  int oblock[LOGSIZE]; // block #s of those data blocks
+  int async;       // FS_ASYNC: commit only when full or forced
+  int forcing;     // # of log_force() callers waiting
+  uint opened;     // ticks when the open transaction took its first block
+  uint tid;        // number of the open transaction
+  uint committed;  // number of the last committed transaction
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void syncer(void);
+
+#define COMMIT_TICKS 50  // oldest an FS_ASYNC transaction gets, ~5 seconds
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,24 +97,51 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.ordered = (sb->flags & FS_ORDERED) != 0;
+  log.async = (sb->flags & FS_ASYNC) != 0;
+  log.tid = 1;
   recover_from_log();
+  if(log.async)
+    kproc("syncer", syncer);
 }
 
+// During recovery each destination block takes a buffer of its
+// own, and the log block it is copied from one more, so a full
+// log would need LOGSIZE+1 buffers at once; install at most this
+// many at a time, leaving the rest for reading the log ahead.
+#define RECOVERMAX (NBUF - BIOMAX - 1)
+#if RECOVERMAX < 1
+#error "NBUF too small to recover the log"
+#endif
+
 // Copy committed blocks from log to their home location
 static void
 install_trans(int recovering)
 {
-  int tail;
+  struct buf *dbuf[LOGSIZE];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (i = 0; i < log.lh.n; i += n) {
+    // outside recovery dbuf is the pinned copy that went to the
+    // log, already cached and already holding what the log holds.
+    n = log.lh.n - i;
+    if(recovering && n > RECOVERMAX)
+      n = RECOVERMAX;
+    for (tail = i; tail < i + n; tail++) {
+      dbuf[tail] = bread(log.dev, log.lh.block[tail]); // read dst
+      if(recovering){
+        // the log blocks are consecutive: read them all at once.
+        struct buf *lbuf = breadn(log.dev, log.start+tail+1, i+n-tail, IO_LOG); // read log block
+        memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+        brelse(lbuf);
+      }
+    }
+    bwritev(dbuf + i, n);  // write dsts to disk, runs coalesced
+    for (tail = i; tail < i + n; tail++) {
+      if(recovering == 0)
+        bunpin(dbuf[tail]);
+      brelse(dbuf[tail]);
+    }
   }
 }
 
@@ -86,7 +149,7 @@ install_trans(int recovering)
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = breadn(log.dev, log.start, 1, IO_LOG);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
   log.lh.n = lh->n;
@@ -102,7 +165,7 @@ read_head(void)
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = breadn(log.dev, log.start, 1, IO_LOG);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
   hb->n = log.lh.n;
@@ -128,9 +191,10 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.forcing){
+      // let the open transaction drain so it can commit.
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.nordered + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -141,11 +205,30 @@ begin_op(void)
   }
 }
 
+// Has the open transaction held changes for COMMIT_TICKS?
+static int
+logold(void)
+{
+  return log.lh.n + log.nordered > 0 && ticks - log.opened >= COMMIT_TICKS;
+}
+
+// Must the open transaction commit once no operation is in it?
+// Always, unless FS_ASYNC; then only when forced, when it is
+// old, or when it has taken so much of the log (and so many
+// pinned buffers) that the next operations might not fit.
+static int
+mustcommit(void)
+{
+  return !log.async || log.forcing > 0 || logold() ||
+    log.lh.n + log.nordered + 2*MAXOPBLOCKS > LOGSIZE;
+}
+
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 // 在 end_op() 前应该释放事务中写过的 buf
 // 因为 end_op() 后续要把更新过的 buf 写（提交）到磁盘的 logged data block 区域
 // 用于崩溃时恢复
+void
 end_op(void)
 {
   int do_commit = 0;
@@ -154,7 +237,7 @@ end_op(void)
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 && mustcommit()){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -176,20 +259,104 @@ end_op(void)
   }
 }
 
+// Number of the transaction that operations joining now are
+// part of; it is durable once log.committed reaches it.
+uint
+log_tid(void)
+{
+  uint tid;
+
+  acquire(&log.lock);
+  tid = log.tid;
+  release(&log.lock);
+  return tid;
+}
+
+// Wait until transaction tid has committed, committing the
+// open transaction now if tid is still it. New operations
+// wait meanwhile, so a busy file system cannot starve us.
+// Must not be called inside a transaction.
+void
+log_force(uint tid)
+{
+  acquire(&log.lock);
+  log.forcing++;
+  while(log.committed < tid){
+    if(log.committing || log.outstanding > 0){
+      // the last end_op() commits, since we are forcing.
+      sleep(&log, &log.lock);
+      continue;
+    }
+    log.committing = 1;
+    release(&log.lock);
+    commit();
+    acquire(&log.lock);
+    log.committing = 0;
+    wakeup(&log);
+  }
+  log.forcing--;
+  wakeup(&log);
+  release(&log.lock);
+}
+
 // Copy modified blocks from cache to log.
+// The log blocks are consecutive on disk, so each request
+// writes BIOMAX of them straight from the cached blocks,
+// without staging copies in buffers of their own. Outside
+// recovery nothing reads log blocks through the cache.
+// All the requests go out before waiting for any of them, so
+// writing the log costs about one disk round trip. The blocks
+// are pinned in the cache, so holding them all takes no buffers
+// from anyone else.
 static void
 write_log(void)
 {
-  int tail;
+  // static: too big for a kernel stack, and commits take turns.
+  static struct buf *from[LOGSIZE];
+  static struct bio bio[(LOGSIZE+BIOMAX-1)/BIOMAX];
+  int tail, i, nbio;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  nbio = 0;
+  for (tail = 0; tail < log.lh.n; tail += bio[nbio++].n) {
+    bio[nbio].dev = log.dev;
+    bio[nbio].blockno = log.start+tail+1; // log block
+    bio[nbio].write = 1;
+    bio[nbio].n = 0;
+    bio[nbio].endio = 0;
+    bio[nbio].flags = 0;
+    bio[nbio].origin = IO_LOG;
+    while(bio[nbio].n < BIOMAX && tail + bio[nbio].n < log.lh.n){
+      i = tail + bio[nbio].n;
+      from[i] = bread(log.dev, log.lh.block[i]); // cache block
+      bio[nbio].data[bio[nbio].n++] = from[i]->data;
+    }
+    bio_submit(&bio[nbio]);  // write the log
   }
+  for (i = 0; i < nbio; i++)
+    bio_wait(&bio[i]);
+  for (tail = 0; tail < log.lh.n; tail++)
+    brelse(from[tail]);
+}
+
+// Write ordered-mode data blocks to their home locations.
+// Must run before write_head(): once the header is on disk the
+// committed inodes may point at these blocks.
+// Sequentially written files give runs of consecutive blocks,
+// which bwritev() sends in single requests.
+static void
+write_ordered(void)
+{
+  struct buf *b[LOGSIZE];
+  int i;
+
+  for (i = 0; i < log.nordered; i++)
+    b[i] = bread(log.dev, log.oblock[i]);
+  bwritev(b, log.nordered);
+  for (i = 0; i < log.nordered; i++) {
+    bunpin(b[i]);
+    brelse(b[i]);
+  }
+  log.nordered = 0;
 }
 
 // 多个线程并发开始事务，要保证的同步有
@@ -204,6 +371,16 @@ write_log(void)
 static void
 commit()
 {
+  struct proc *p = myproc();
+  int prio = p->ioprio;
+
+  // every writer waiting in begin_op() waits for this commit,
+  // so an idle-class committer's requests must not be held back
+  // behind everyone else's: commit at best effort at least.
+  if(prio > IOPRIO_BE)
+    p->ioprio = IOPRIO_BE;
+  if (log.nordered > 0)
+    write_ordered(); // Data first, so no committed inode points at stale blocks
   if (log.lh.n > 0) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
@@ -211,6 +388,10 @@ commit()
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
   }
+  p->ioprio = prio;
+  acquire(&log.lock);
+  log.committed = log.tid++;
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -228,10 +409,22 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n + log.nordered >= LOGSIZE || log.lh.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
+  if (log.lh.n + log.nordered == 0)
+    log.opened = ticks;
+
+  // a data block freed and reused as metadata in this
+  // transaction must not reach its home location early.
+  for (i = 0; i < log.nordered; i++) {
+    if (log.oblock[i] == b->blockno) {
+      log.oblock[i] = log.oblock[--log.nordered];
+      bunpin(b);
+      break;
+    }
+  }
 
   for (i = 0; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorption
@@ -245,3 +438,70 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Caller has modified file data in b and is done with the buffer.
+// Without FS_ORDERED this is log_write(). In ordered mode the
+// block is only pinned and remembered; commit() writes it in
+// place before the transaction's metadata commits.
+void
+log_write_data(struct buf *b)
+{
+  int i;
+
+  if (!log.ordered) {
+    log_write(b);
+    return;
+  }
+
+  acquire(&log.lock);
+  if (log.lh.n + log.nordered >= LOGSIZE)
+    panic("too big a transaction");
+  if (log.outstanding < 1)
+    panic("log_write_data outside of trans");
+  if (log.lh.n + log.nordered == 0)
+    log.opened = ticks;
+
+  // already journaled in this transaction (e.g. a freed directory
+  // block reused for data): leave it in the log.
+  for (i = 0; i < log.lh.n; i++) {
+    if (log.lh.block[i] == b->blockno) {
+      release(&log.lock);
+      return;
+    }
+  }
+
+  for (i = 0; i < log.nordered; i++) {
+    if (log.oblock[i] == b->blockno)   // absorption
+      break;
+  }
+  log.oblock[i] = b->blockno;
+  if (i == log.nordered) {
+    bpin(b);
+    log.nordered++;
+  }
+  release(&log.lock);
+}
+
+// The syncer process of an FS_ASYNC file system: commits the
+// open transaction once it is old, for when no end_op() comes
+// along to do it.
+static void
+syncer(void)
+{
+  uint t0, tid;
+  int old;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < COMMIT_TICKS / 2)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    acquire(&log.lock);
+    old = logold();
+    tid = log.tid;
+    release(&log.lock);
+    if(old)
+      log_force(tid);
+  }
+}
@@ -32,8 +32,12 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    dcinit();        // directory entry cache
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
+    ramdiskinit();   // RAM disk
+    tmpinit();       // in-memory file system
+    blkinit();       // block request layer
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
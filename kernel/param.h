@@ -2,14 +2,29 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-nodes kept in memory before unused ones are recycled
+#define NDCACHE     128  // size of directory entry cache
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#define DISKDEV       1  // device number of the virtio disk
+#define RAMDEV        2  // device number of the RAM disk
+#ifndef ROOTDEV
+#define ROOTDEV       DISKDEV  // device number of file system root disk
+#endif
+#define NDISK         4  // block devices, numbered 0..NDISK-1
+#define TMPDEV        4  // device number of tmpfs, which has no disk
+#define NFSDEV        8  // file system devices, numbered 0..NFSDEV-1
+#define NMOUNT        4  // mount points
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*6)  // max data blocks in on-disk log; FS_ASYNC batches up to LOGSIZE-2*MAXOPBLOCKS
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // size of disk block cache: the log's pinned blocks and room to read
+#define BIOMAX       16    // max blocks in one disk request
 #define FSSIZE       2000  // size of file system in blocks
+#define RAMBLOCKS    FSSIZE  // size of the RAM disk in blocks, unless RAMROOT
+#define NTNODE       200   // tmpfs inodes
+#define TMPPAGES     1024  // most memory pages tmpfs may hold
+#define NGROUP       8     // max allocation groups per file system
 #define MAXPATH      128   // maximum file path name
+#define MNTFLAGS     0x4   // FS_* flags forced on when mounting the root fs; 0x4 is FS_DIRINDEX
 #define USERSTACK    1     // user stack pages
 
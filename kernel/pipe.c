@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "buf.h"
 
 #define PIPESIZE 512
 
@@ -133,3 +134,112 @@ piperead(struct pipe *pi, uint64 addr, int n)
   release(&pi->lock);
   return i;
 }
+
+// Copy up to n bytes from kernel address src into the pipe
+// without waiting for room. Returns the number of bytes
+// copied, or -1 if nobody will ever read them.
+static int
+pipeput(struct pipe *pi, char *src, int n)
+{
+  int i, m;
+
+  acquire(&pi->lock);
+  if(pi->readopen == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  for(i = 0; i < n && pi->nwrite != pi->nread + PIPESIZE; i += m){
+    m = n - i;
+    if(m > PIPESIZE - pi->nwrite % PIPESIZE)
+      m = PIPESIZE - pi->nwrite % PIPESIZE;
+    if(m > pi->nread + PIPESIZE - pi->nwrite)
+      m = pi->nread + PIPESIZE - pi->nwrite;
+    memmove(&pi->data[pi->nwrite % PIPESIZE], src + i, m);
+    pi->nwrite += m;
+  }
+  wakeup(&pi->nread);
+  release(&pi->lock);
+  return i;
+}
+
+// Copy up to n bytes out of the pipe to kernel address dst
+// without waiting for data. Returns the number copied.
+static int
+pipeget(struct pipe *pi, char *dst, int n)
+{
+  int i, m;
+
+  acquire(&pi->lock);
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){
+    m = n - i;
+    if(m > PIPESIZE - pi->nread % PIPESIZE)
+      m = PIPESIZE - pi->nread % PIPESIZE;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    memmove(dst + i, &pi->data[pi->nread % PIPESIZE], m);
+    pi->nread += m;
+  }
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+  return i;
+}
+
+// Sleep until the pipe has room (writing) or data (!writing).
+// Returns how many bytes of room or data it has then, 0 if it
+// never will because the other end is closed, -1 if the
+// process was killed.
+// 调用者不能持有 inode 或 buf 的锁: 对端可能正等着它们
+int
+pipewait(struct pipe *pi, int writing)
+{
+  struct proc *pr = myproc();
+  int r;
+
+  acquire(&pi->lock);
+  for(;;){
+    if(killed(pr)){
+      r = -1;
+      break;
+    }
+    if(writing){
+      if(pi->readopen == 0){
+        r = 0;
+        break;
+      }
+      if(pi->nwrite != pi->nread + PIPESIZE){
+        r = pi->nread + PIPESIZE - pi->nwrite;
+        break;
+      }
+      wakeup(&pi->nread);
+      sleep(&pi->nwrite, &pi->lock);
+    } else {
+      if(pi->nread != pi->nwrite){
+        r = pi->nwrite - pi->nread;
+        break;
+      }
+      if(pi->writeopen == 0){
+        r = 0;
+        break;
+      }
+      sleep(&pi->nread, &pi->lock);
+    }
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// iactor for readi_actor(): move file data from a cached block
+// into the pipe, taking only as much as fits right now.
+int
+pipefill(void *pi, struct buf *bp, uint boff, uint n)
+{
+  return pipeput(pi, (char*)bp->data + boff, n);
+}
+
+// iactor for writei_actor(): move whatever the pipe holds right
+// now into a cached block.
+int
+pipedrain(void *pi, struct buf *bp, uint boff, uint n)
+{
+  return pipeget(pi, (char*)bp->data + boff, n);
+}
@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "ioprio.h"
 
 struct cpu cpus[NCPU];
 
@@ -297,6 +298,7 @@ void userinit(void)
   p->trapframe->sp = PGSIZE; // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
+  p->ioprio = IOPRIO_BE;
   p->cwd = namei("/");
 
   p->state = RUNNABLE;
@@ -304,6 +306,34 @@ void userinit(void)
   release(&p->lock);
 }
 
+// A kernel process's first scheduling swtch()es here.
+static void
+kprocstart(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+  myproc()->kfn();
+  panic("kproc returned");
+}
+
+// Start a process that runs fn() in the kernel and never
+// returns to user space; fn() must not return.
+// 内核进程: 没有用户空间, 只在内核中运行 fn()
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->kfn = fn;
+  p->ioprio = IOPRIO_BE;
+  p->context.ra = (uint64)kprocstart;
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 // 增长进程能使用的虚拟地址
@@ -374,6 +404,7 @@ int fork(void)
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  np->ioprio = p->ioprio;
 
   pid = np->pid;
 
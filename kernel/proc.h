@@ -104,4 +104,6 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int ioprio;                  // I/O priority class, IOPRIO_*
+  void (*kfn)(void);           // what a kproc() runs
 };
@@ -0,0 +1,100 @@
+//
+// RAM disk: block device RAMDEV, RAMBLOCKS blocks held in
+// kalloc()ed pages.
+//
+// It starts out zeroed, or, when the kernel is built with
+// RAMROOT=1, is fs.img itself, linked into the kernel by the
+// Makefile: its blocks are the image's bytes in the kernel's
+// data, as many as the image has, whatever mkfs -s made it.
+// It is then also the root device, and the file system runs
+// without disk I/O. Requests complete as they are submitted,
+// so nobody waits for them.
+//
+// Otherwise a page is allocated when a block in it is first
+// written, and blocks in pages never written read as zeros, so
+// an unused RAM disk costs no memory.
+//
+// 内存盘: 用内存页模拟块设备, 读写就是 memmove
+// 用于测量 fs.c/log.c 本身的开销, 以及存放临时文件
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+
+#define NRAMPAGE ((RAMBLOCKS * BSIZE + PGSIZE - 1) / PGSIZE)
+
+struct {
+  struct spinlock lock;
+  uint nblocks;
+#ifndef RAMIMG
+  char *page[NRAMPAGE];
+#endif
+} ram;
+
+#ifdef RAMIMG
+extern char _binary_fs_img_start[], _binary_fs_img_end[];
+#endif
+
+// the memory holding block b, or 0 if its page has never
+// been written; alloc says to allocate the page then.
+static char*
+ramblock(uint b, int alloc)
+{
+  uint64 off = (uint64)b * BSIZE;
+#ifdef RAMIMG
+  return _binary_fs_img_start + off;
+#else
+  char **pp = &ram.page[off / PGSIZE];
+
+  if(*pp == 0 && alloc){
+    if((*pp = kalloc()) == 0)
+      panic("ramdisk: out of memory");
+    memset(*pp, 0, PGSIZE);
+  }
+  return *pp ? *pp + off % PGSIZE : 0;
+#endif
+}
+
+static void
+ramdiskrw(struct bio *bio)
+{
+  char *p;
+  int i;
+
+  if(bio->blockno + bio->n > ram.nblocks)
+    panic("ramdiskrw: blockno");
+
+  acquire(&ram.lock);
+  for(i = 0; i < bio->n; i++){
+    p = ramblock(bio->blockno + i, bio->write);
+    if(bio->write)
+      memmove(p, bio->data[i], BSIZE);
+    else if(p)
+      memmove(bio->data[i], p, BSIZE);
+    else
+      memset(bio->data[i], 0, BSIZE);
+  }
+  bio_endio(bio, 1);
+  release(&ram.lock);
+}
+
+void
+ramdiskinit(void)
+{
+  initlock(&ram.lock, "ramdisk");
+
+#ifdef RAMIMG
+  ram.nblocks = (_binary_fs_img_end - _binary_fs_img_start) / BSIZE;
+#else
+  ram.nblocks = RAMBLOCKS;
+#endif
+
+  bdevsw[RAMDEV].submit = ramdiskrw;
+  bdevsw[RAMDEV].depth = 1;  // each request completes as it is submitted
+}
@@ -9,3 +9,14 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// File system totals, as reported by statfs().
+struct statfs {
+  uint bsize;   // Block size in bytes
+  uint blocks;  // Blocks in the file system, metadata included
+  uint bfree;   // Free blocks
+  uint files;   // Inodes
+  uint ffree;   // Free inodes
+  uint ngroup;  // Allocation groups
+  uint flags;   // FS_* features in use (fs.h)
+};
@@ -101,6 +101,22 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_statfs(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_ioprio(void);
+extern uint64 sys_iopoll(void);
+extern uint64 sys_iostat(void);
+extern uint64 sys_mount(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +142,22 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_statfs]  sys_statfs,
+[SYS_sendfile] sys_sendfile,
+[SYS_splice]  sys_splice,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_lseek]   sys_lseek,
+[SYS_fallocate] sys_fallocate,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_sync]    sys_sync,
+[SYS_ioprio]  sys_ioprio,
+[SYS_iopoll]  sys_iopoll,
+[SYS_iostat]  sys_iostat,
+[SYS_mount]   sys_mount,
 };
 
 void
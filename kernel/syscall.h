@@ -20,3 +20,19 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_statfs 22
+#define SYS_sendfile 23
+#define SYS_splice 24
+#define SYS_pread 25
+#define SYS_pwrite 26
+#define SYS_readv 27
+#define SYS_writev 28
+#define SYS_lseek 29
+#define SYS_fallocate 30
+#define SYS_fsync 31
+#define SYS_fdatasync 32
+#define SYS_sync 33
+#define SYS_ioprio 34
+#define SYS_iopoll 35
+#define SYS_iostat 36
+#define SYS_mount  37
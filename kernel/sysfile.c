@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "iostat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -94,6 +96,189 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Read or write n bytes at an explicit file offset,
+// leaving the descriptor's own offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Fetch the iovec array named by the nth and n+1th system call
+// arguments into iov, which holds IOV_MAX entries.
+// Returns the number of entries, or -1 if the array is too long
+// or adds up to more than an int can count.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 addr, tot;
+  int cnt, i;
+
+  argaddr(n, &addr);
+  argint(n+1, &cnt);
+  if(cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, cnt*sizeof(struct iovec)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].iov_len > 0x7fffffff)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+  if(tot > 0x7fffffff)
+    return -1;
+  return cnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov)) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov)) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filelseek(f, off, whence);
+}
+
+// Reserve the blocks for bytes [off, off+len) of a file.
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  argint(1, &off);
+  argint(2, &len);
+  if(argfd(0, 0, &f) < 0 || off < 0 || len < 0)
+    return -1;
+  return filefallocate(f, off, len);
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f, 0);
+}
+
+uint64
+sys_fdatasync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f, 1);
+}
+
+// Commit everything written so far.
+uint64
+sys_sync(void)
+{
+  log_force(log_tid());
+  return 0;
+}
+
+// Copy block device dev's I/O counters to user memory.
+uint64
+sys_iostat(void)
+{
+  int dev;
+  uint64 addr;
+  struct iostat st;
+
+  argint(0, &dev);
+  argaddr(1, &addr);
+  if(dev < 0 || blkstat(dev, &st) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Move n bytes of file in, from offset off (or from its own
+// offset when off is -1), to file out inside the kernel.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+
+  argint(2, &off);
+  argint(3, &n);
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0)
+    return -1;
+  return filesend(out, in, off, n);
+}
+
+// Move n bytes between a pipe and a file inside the kernel.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 uint64
 sys_close(void)
 {
@@ -119,6 +304,31 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Report free space on the file system holding path.
+uint64
+sys_statfs(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  struct statfs st;
+  uint64 addr; // user pointer to struct statfs
+
+  argaddr(1, &addr);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  fsstat(ip->dev, &st);
+  iput(ip);
+  end_op();
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -189,7 +399,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -214,13 +423,12 @@ sys_unlink(void)
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ip->type == T_DIR && (!isdirempty(ip) || mntpoint(ip))){
     iunlockput(ip);
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  if(dirunlink(dp, name, off) < 0)
     panic("unlink: writei");
   if(ip->type == T_DIR){
     dp->nlink--;
@@ -272,7 +480,7 @@ create(char *path, short type, short major, short minor)
 
   // 如果要创建的文件不存在，就分配一个 inode
   // 如果 inode 分配失败
-  if((ip = ialloc(dp->dev, type)) == 0){
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0){
     iunlockput(dp);
     return 0;
   }
@@ -451,6 +659,38 @@ sys_chdir(void)
   return 0;
 }
 
+// Mount a file system of type fstype on directory path.
+// Each type other than the root's has one instance, on its own
+// device; see fsmount().
+uint64
+sys_mount(void)
+{
+  char fstype[16], path[MAXPATH];
+  struct inode *ip;
+
+  if(argstr(0, fstype, sizeof(fstype)) < 0 || argstr(1, path, MAXPATH) < 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  if(fsmount(ip, fstype) < 0){
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  end_op();
+  return 0;
+}
+
 uint64
 sys_exec(void)
 {
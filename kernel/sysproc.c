@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "ioprio.h"
 
 uint64
 sys_exit(void)
@@ -91,3 +92,33 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// set the I/O priority class of the calling process, unless
+// class is -1, and return the old one.
+uint64
+sys_ioprio(void)
+{
+  struct proc *p = myproc();
+  int class, old;
+
+  argint(0, &class);
+  if(class < -1 || class >= NIOPRIO)
+    return -1;
+  old = p->ioprio;
+  if(class >= 0)
+    p->ioprio = class;
+  return old;
+}
+
+// set the disk completion polling mode, unless mode is -1,
+// and return the old one. the mode is system-wide.
+uint64
+sys_iopoll(void)
+{
+  int mode;
+
+  argint(0, &mode);
+  if(mode < -1 || mode > IOPOLL_ALL)
+    return -1;
+  return blkpoll(mode);
+}
@@ -0,0 +1,370 @@
+// Temporary file system.
+//
+// A file system kept entirely in memory, mounted with
+// mount("tmpfs", path). Its inodes are struct tnodes in tmp.node[],
+// on device TMPDEV, and their content lives in kalloc()ed pages
+// reached from the tnode, so reading and writing a file is a
+// memmove: nothing goes through the buffer cache, the log or a
+// disk, and nothing survives a reboot. Directories are files of
+// struct dirents, as on disk, so the plain directory operations
+// dirscan(), dirappend() and direrase() serve it unchanged.
+//
+// fs.c keeps tmpfs inodes in the inode table like any others,
+// and calls in here, through tmpops and tmpiops, where a disk
+// inode would reach the disk: tmpiload() and tmpiupdate() stand
+// in for reading and writing the dinode, tmpread() and
+// tmpwrite() for the block-mapped content. A tnode's fields are
+// used only with the inode locked.
+//
+// 内存文件系统: inode 和数据都在内存页中, 不经过块缓存、日志和磁盘
+// 适合存放临时文件
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+
+#define NTDIRECT    12
+#define NTINDIRECT  (PGSIZE / sizeof(char*))
+#define MAXTFILE    (NTDIRECT + NTINDIRECT)  // most pages in a file
+
+// in-memory inode of a tmpfs file.
+struct tnode {
+  short type;           // 0 if free
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char *page[NTDIRECT]; // content pages; 0 for a hole
+  char **ind;           // page of NTINDIRECT more, or 0
+};
+
+struct {
+  struct spinlock lock; // protects npages and allocating tnodes
+  uint npages;          // pages held, ind pages included
+  char *zero;           // a page of zeros, read from holes
+  struct tnode node[NTNODE];
+} tmp;
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+static struct vfsops tmpops;
+
+// Set up an empty file system: just the root directory.
+void
+tmpinit(void)
+{
+  struct tnode *t = &tmp.node[ROOTINO];
+  struct dirent *de;
+
+  initlock(&tmp.lock, "tmpfs");
+  if((tmp.zero = kalloc()) == 0 || (t->page[0] = kalloc()) == 0)
+    panic("tmpinit");
+  memset(tmp.zero, 0, PGSIZE);
+  memset(t->page[0], 0, PGSIZE);
+  tmp.npages = 1;
+
+  // ".." is the root itself; namex() steps out of the file
+  // system at its root.
+  de = (struct dirent*)t->page[0];
+  de[0].inum = ROOTINO;
+  safestrcpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = ROOTINO;
+  safestrcpy(de[1].name, "..", DIRSIZ);
+  t->type = T_DIR;
+  t->nlink = 1;
+  t->size = 2 * sizeof(*de);
+  vfssw[TMPDEV] = &tmpops;
+}
+
+// Allocate a zeroed page, within the TMPPAGES limit.
+static char*
+tpalloc(void)
+{
+  char *p;
+
+  acquire(&tmp.lock);
+  if(tmp.npages >= TMPPAGES){
+    release(&tmp.lock);
+    return 0;
+  }
+  tmp.npages++;
+  release(&tmp.lock);
+  if((p = kalloc()) == 0){
+    acquire(&tmp.lock);
+    tmp.npages--;
+    release(&tmp.lock);
+    return 0;
+  }
+  memset(p, 0, PGSIZE);
+  return p;
+}
+
+static void
+tpfree(void *p)
+{
+  kfree(p);
+  acquire(&tmp.lock);
+  tmp.npages--;
+  release(&tmp.lock);
+}
+
+// Return the page holding page pn of t's content, or 0 for a
+// hole. If alloc is set, fill a hole with a new page; then 0
+// means out of memory or past MAXTFILE.
+static char*
+tpage(struct tnode *t, uint pn, int alloc)
+{
+  char **pp;
+
+  if(pn < NTDIRECT){
+    pp = &t->page[pn];
+  } else {
+    pn -= NTDIRECT;
+    if(pn >= NTINDIRECT)
+      return 0;
+    if(t->ind == 0 && (!alloc || (t->ind = (char**)tpalloc()) == 0))
+      return 0;
+    pp = &t->ind[pn];
+  }
+  if(*pp == 0 && alloc)
+    *pp = tpalloc();
+  return *pp;
+}
+
+// Allocate a tnode of the given type. Returns its inode
+// number, or 0 if there is none free.
+static uint
+tmpialloc(uint dev, short type, uint parent)
+{
+  struct tnode *t;
+
+  acquire(&tmp.lock);
+  for(t = &tmp.node[ROOTINO+1]; t < &tmp.node[NTNODE]; t++){
+    if(t->type == 0){
+      memset(t, 0, sizeof(*t));
+      t->type = type;
+      release(&tmp.lock);
+      return t - tmp.node;
+    }
+  }
+  release(&tmp.lock);
+  printf("tmpialloc: no inodes\n");
+  return 0;
+}
+
+// Fill in a tmpfs inode being locked for the first time.
+static void
+tmpiload(struct inode *ip)
+{
+  struct tnode *t = &tmp.node[ip->inum];
+
+  ip->type = t->type;
+  ip->major = t->major;
+  ip->minor = t->minor;
+  ip->nlink = t->nlink;
+  ip->size = t->size;
+  ip->flags = 0;
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->indaddr = 0;
+  ip->goal = 0;
+  ip->tid = ip->dtid = 0;   // always durable, as far as fsync() cares
+}
+
+// Save a tmpfs inode's changes. A type of 0 is left for
+// tmpifree() to store, under tmp.lock.
+static void
+tmpiupdate(struct inode *ip)
+{
+  struct tnode *t = &tmp.node[ip->inum];
+
+  t->major = ip->major;
+  t->minor = ip->minor;
+  t->nlink = ip->nlink;
+  t->size = ip->size;
+  if(ip->type != 0)
+    t->type = ip->type;
+}
+
+// Free a tmpfs inode's tnode, whose content tmpitrunc() must
+// already have freed.
+static void
+tmpifree(struct inode *ip)
+{
+  acquire(&tmp.lock);
+  tmp.node[ip->inum].type = 0;
+  release(&tmp.lock);
+}
+
+// Free a tmpfs inode's content.
+static void
+tmpitrunc(struct inode *ip)
+{
+  struct tnode *t = &tmp.node[ip->inum];
+  int i;
+
+  for(i = 0; i < NTDIRECT; i++){
+    if(t->page[i]){
+      tpfree(t->page[i]);
+      t->page[i] = 0;
+    }
+  }
+  if(t->ind){
+    for(i = 0; i < NTINDIRECT; i++){
+      if(t->ind[i])
+        tpfree(t->ind[i]);
+    }
+    tpfree(t->ind);
+    t->ind = 0;
+  }
+  ip->size = 0;
+  tmpiupdate(ip);
+}
+
+// readi_actor() for tmpfs. The actor gets a buf of our own over
+// the page, a block at a time, marked B_NOSTEAL so bsteal() will
+// not take the page away.
+static int
+tmpread(struct inode *ip, uint off, uint n, iactor actor, void *arg)
+{
+  struct tnode *t = &tmp.node[ip->inum];
+  struct buf b;
+  uint tot, m;
+  int r;
+  char *p;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  initsleeplock(&b.lock, "tmpbuf");
+  acquiresleep(&b.lock);
+  b.refcnt = 0;
+  b.flags = B_NOSTEAL;
+  for(tot = 0; tot < n; tot += r, off += r){
+    if((p = tpage(t, off / PGSIZE, 0)) == 0)
+      p = tmp.zero;
+    m = min(n - tot, BSIZE - off % BSIZE);
+    b.data = (uchar*)p + off % PGSIZE - off % BSIZE;
+    if((r = actor(arg, &b, off % BSIZE, m)) < 0){
+      releasesleep(&b.lock);
+      return -1;
+    }
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+  releasesleep(&b.lock);
+  return tot;
+}
+
+// writei_actor() for tmpfs.
+static int
+tmpwrite(struct inode *ip, uint off, uint n, iactor actor, void *arg)
+{
+  struct tnode *t = &tmp.node[ip->inum];
+  struct buf b;
+  uint tot, m;
+  int r;
+  char *p;
+
+  if(off + n < off || off + n > MAXTFILE*PGSIZE)
+    return -1;
+
+  initsleeplock(&b.lock, "tmpbuf");
+  acquiresleep(&b.lock);
+  b.refcnt = 0;
+  b.flags = B_NOSTEAL;
+  for(tot = 0; tot < n; tot += r, off += r){
+    if((p = tpage(t, off / PGSIZE, 1)) == 0)
+      break;
+    m = min(n - tot, BSIZE - off % BSIZE);
+    b.data = (uchar*)p + off % PGSIZE - off % BSIZE;
+    if((r = actor(arg, &b, off % BSIZE, m)) <= 0)
+      break;
+    if(r < m){
+      tot += r;
+      off += r;
+      break;
+    }
+  }
+  releasesleep(&b.lock);
+
+  if(tot > 0 && off > ip->size)
+    ip->size = off;
+  tmpiupdate(ip);
+  return tot;
+}
+
+// falloci() for tmpfs: give bytes [off, off+n) pages, and
+// grow ip to cover them.
+static int
+tmpfalloc(struct inode *ip, uint off, uint n)
+{
+  struct tnode *t = &tmp.node[ip->inum];
+  uint pn;
+  int r;
+
+  if(off + n < off || off + n > MAXTFILE*PGSIZE)
+    return -1;
+  r = 0;
+  for(pn = off / PGSIZE; n > 0 && pn <= (off + n - 1) / PGSIZE; pn++){
+    if(tpage(t, pn, 1) == 0){
+      r = -1;
+      break;
+    }
+  }
+  if(r == 0 && off + n > ip->size)
+    ip->size = off + n;
+  tmpiupdate(ip);
+  return r;
+}
+
+// fsstat() for tmpfs, in pages.
+static void
+tmpstat(uint dev, struct statfs *st)
+{
+  struct tnode *t;
+
+  acquire(&tmp.lock);
+  st->bsize = PGSIZE;
+  st->blocks = TMPPAGES;
+  st->bfree = TMPPAGES - tmp.npages;
+  st->files = NTNODE - 1;
+  st->ffree = 0;
+  for(t = &tmp.node[ROOTINO+1]; t < &tmp.node[NTNODE]; t++){
+    if(t->type == 0)
+      st->ffree++;
+  }
+  st->ngroup = 1;
+  st->flags = 0;
+  release(&tmp.lock);
+}
+
+static struct iops tmpiops = {
+  .load = tmpiload,
+  .update = tmpiupdate,
+  .free = tmpifree,
+  .trunc = tmpitrunc,
+  .falloc = tmpfalloc,
+  .read = tmpread,
+  .write = tmpwrite,
+  .lookup = dirscan,
+  .link = dirappend,
+  .unlink = direrase,
+};
+
+static struct vfsops tmpops = {
+  .name = "tmpfs",
+  .ialloc = tmpialloc,
+  .statfs = tmpstat,
+  .iops = &tmpiops,
+};
@@ -0,0 +1,7 @@
+#define IOV_MAX 16  // most pieces in one readv()/writev()
+
+// One piece of user memory for readv() and writev().
+struct iovec {
+  void *iov_base;   // Start address
+  uint64 iov_len;   // Length in bytes
+};
@@ -29,6 +29,7 @@
 #define VIRTIO_MMIO_DRIVER_DESC_HIGH	0x094
 #define VIRTIO_MMIO_DEVICE_DESC_LOW	0x0a0 // physical address for used ring, write-only
 #define VIRTIO_MMIO_DEVICE_DESC_HIGH	0x0a4
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration space
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -45,9 +46,13 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// at most this many virtqueues (VIRTIO_BLK_F_MQ); one per hart.
+#define NVQ NCPU
+
+// at most this many virtio descriptors; the queue gets fewer
+// if the device's QUEUE_NUM_MAX is smaller.
+// must be a power of two, and NUM descriptors fill one page.
+#define NUM 256
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -58,13 +63,14 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr/len is a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
   uint16 flags; // always zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 unused;    // used_event, when the queue has NUM entries
 };
 
 // one entry in the "used" ring, with which the
@@ -80,15 +86,26 @@ struct virtq_used {
   struct virtq_used_elem ring[NUM];
 };
 
+// with VIRTIO_RING_F_EVENT_IDX, a 16-bit event index follows
+// each ring of a queue with n entries. the driver writes
+// used_event: interrupt me once used->idx passes it. the device
+// writes avail_event: notify me once avail->idx passes it.
+#define VQ_USED_EVENT(avail, n) ((volatile uint16 *)&(avail)->ring[n])
+#define VQ_AVAIL_EVENT(used, n) ((volatile uint16 *)&(used)->ring[n])
+
 // these are specific to virtio block devices, e.g. disks,
 // described in Section 5.2 of the spec.
 
+// offset of the 16-bit num_queues in the virtio-blk
+// configuration space; valid with VIRTIO_BLK_F_MQ.
+#define VIRTIO_BLK_CFG_NUM_QUEUES 34
+
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
 // the format of the first descriptor in a disk request.
-// to be followed by two more descriptors containing
-// the block, and a one-byte status.
+// to be followed by descriptors for the data, one per
+// block, and one for a one-byte status.
 struct virtio_blk_req {
   uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
   uint32 reserved;
@@ -19,10 +19,15 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
-static struct disk {
+// one virtqueue, and the requests in flight on it.
+// each queue has its own lock, so harts submitting to
+// different queues do not contend.
+struct vq {
+  struct spinlock lock;
+
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
-  // disk operations. there are NUM descriptors.
+  // disk operations. there are disk.num descriptors.
   // most commands consist of a "chain" (a linked list) of a couple of
   // these descriptors.
   struct virtq_desc *desc;
@@ -30,12 +35,12 @@ static struct disk {
   // a ring in which the driver writes descriptor numbers
   // that the driver would like the device to process.  it only
   // includes the head descriptor of each chain. the ring has
-  // NUM elements.
+  // disk.num elements.
   struct virtq_avail *avail;
 
   // a ring in which the device writes descriptor numbers that
   // the device has finished processing (just the head of each chain).
-  // there are NUM used ring entries.
+  // there are disk.num used ring entries.
   struct virtq_used *used;
 
   // our own book-keeping.
@@ -46,25 +51,119 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct bio *bio;
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
-  struct spinlock vdisk_lock;
-  
+
+  // with VIRTIO_RING_F_INDIRECT_DESC, a request takes a single
+  // ring descriptor, which points at a table holding its chain.
+  // one table per ring descriptor, carved from kalloc()ed pages.
+  struct virtq_desc *ind[NUM];
+};
+
+static struct disk {
+  uint16 num;      // queue size: NUM, or less if the device wants
+  int nq;          // queues in use; hart h submits to q[h % nq] if it has room
+  int indirect;    // negotiated VIRTIO_RING_F_INDIRECT_DESC
+  int eventidx;    // negotiated VIRTIO_RING_F_EVENT_IDX
+  struct vq q[NVQ];
 } disk;
 
+// a request's chain: header, a descriptor per block, status.
+#define NCHAIN (BIOMAX + 2)
+
+// set up virtqueue i, which the device must offer.
+static void
+vq_init(int i)
+{
+  struct vq *q = &disk.q[i];
+
+  initlock(&q->lock, "virtio_disk");
+
+  *R(VIRTIO_MMIO_QUEUE_SEL) = i;
+
+  // ensure the queue is not in use.
+  if(*R(VIRTIO_MMIO_QUEUE_READY))
+    panic("virtio disk should not be ready");
+
+  // check maximum queue size, and use as much of it as we can:
+  // without indirect tables a request takes a descriptor per
+  // block plus two, and a queue too short for one such chain is
+  // too short in either mode.
+  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max == 0)
+    panic("virtio disk has no queue");
+  if(i == 0){
+    disk.num = NUM;
+    while(disk.num > max)
+      disk.num /= 2;
+    if(disk.num < NCHAIN)
+      panic("virtio disk max queue too short");
+  } else if(max < disk.num)
+    panic("virtio disk queues differ");
+
+  // allocate and zero queue memory.
+  q->desc = kalloc();
+  q->avail = kalloc();
+  q->used = kalloc();
+  if(!q->desc || !q->avail || !q->used)
+    panic("virtio disk kalloc");
+  memset(q->desc, 0, PGSIZE);
+  memset(q->avail, 0, PGSIZE);
+  memset(q->used, 0, PGSIZE);
+
+  // set queue size.
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
+
+  // write physical addresses.
+  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)q->desc;
+  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)q->desc >> 32;
+  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)q->avail;
+  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)q->avail >> 32;
+  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)q->used;
+  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)q->used >> 32;
+
+  // queue is ready.
+  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+
+  // all the descriptors start out unused.
+  for(int j = 0; j < disk.num; j++)
+    q->free[j] = 1;
+
+  if(disk.indirect){
+    char *pg = 0;
+    int per = PGSIZE / (NCHAIN * sizeof(struct virtq_desc));
+    for(int j = 0; j < disk.num; j++){
+      if(j % per == 0 && (pg = kalloc()) == 0)
+        panic("virtio disk kalloc");
+      q->ind[j] = (struct virtq_desc *)pg + (j % per) * NCHAIN;
+    }
+  }
+
+  // with EVENT_IDX, interrupt us for the first completion.
+  if(disk.eventidx)
+    *VQ_USED_EVENT(q->avail, disk.num) = 0;
+}
+
+// How many requests of BIOMAX blocks fit in the queues. The
+// block layer keeps no more than this at the driver, so some
+// queue always has room and virtio_disk_submit() always finds
+// free descriptors.
+static int
+depth(void)
+{
+  return (disk.indirect ? disk.num : disk.num / NCHAIN) * disk.nq;
+}
+
 void
 virtio_disk_init(void)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
-
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 2 ||
      *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
@@ -88,11 +187,10 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
+  disk.eventidx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -103,62 +201,49 @@ virtio_disk_init(void)
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-
-  // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
-    panic("virtio disk should not be ready");
-
-  // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-
-  // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
-    panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
-
-  // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-
-  // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
-
-  // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
-
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+  // with VIRTIO_BLK_F_MQ the device says how many queues it
+  // has; use one per hart, as far as they go.
+  disk.nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ)){
+    disk.nq = *(volatile uint16 *)(VIRTIO0 + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CFG_NUM_QUEUES);
+    if(disk.nq > NVQ)
+      disk.nq = NVQ;
+    if(disk.nq < 1)
+      disk.nq = 1;
+  }
+  for(int i = 0; i < disk.nq; i++)
+    vq_init(i);
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
   *R(VIRTIO_MMIO_STATUS) = status;
 
+  bdevsw[DISKDEV].submit = virtio_disk_submit;
+  bdevsw[DISKDEV].poll = virtio_disk_poll;
+  bdevsw[DISKDEV].depth = depth();
+
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
+// the queue for requests submitted on this hart.
+static struct vq*
+myvq(void)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+  return &disk.q[id % disk.nq];
+}
+
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *q)
 {
-  for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+  for(int i = 0; i < disk.num; i++){
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
@@ -167,28 +252,27 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct vq *q, int i)
 {
-  if(i >= NUM)
+  if(i >= disk.num)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->desc[i].len = 0;
+  q->desc[i].flags = 0;
+  q->desc[i].next = 0;
+  q->free[i] = 1;
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct vq *q, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = q->desc[i].flags;
+    int nxt = q->desc[i].next;
+    free_desc(q, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -196,106 +280,181 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(struct vq *q, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// would moving an event-index counter from old to new pass
+// event? (vring_need_event() in the spec.)
+static int
+need_event(uint16 event, uint16 new, uint16 old)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  return (uint16)(new - event - 1) < (uint16)(new - old);
+}
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
+// Start disk request bio, which moves bio->n consecutive
+// blocks in a single virtio request, and return without
+// waiting. virtio_disk_intr() completes it. Does not sleep.
+void
+virtio_disk_submit(struct bio *bio)
+{
+  uint64 sector = bio->blockno * (BSIZE / 512);
+  int i, n = bio->n + 2;
+  struct vq *q = myvq();
+  struct virtq_desc chain[NCHAIN];
+
+  if(bio->n < 1 || bio->n > BIOMAX)
+    panic("virtio_disk_submit");
+
+  // the spec's Section 5.2 says that block operations use a
+  // descriptor for type/reserved/sector, descriptors for the
+  // data, and one for a 1-byte status result.
+
+  // allocate the ring descriptors: just one for an indirect
+  // table, otherwise one for each link of the chain. this
+  // hart's queue may be full of other harts' requests; then
+  // another has room, since the block layer keeps no more than
+  // depth() at the driver.
+  int idx[NCHAIN];
+  int nring = disk.indirect ? 1 : n;
+  for(i = 0; ; i++){
+    if(i == disk.nq)
+      panic("virtio_disk_submit: rings full");
+    acquire(&q->lock);
+    if(alloc_descs(q, idx, nring) == 0)
       break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    release(&q->lock);
+    q = &disk.q[(q - disk.q + 1) % disk.nq];
   }
 
-  // format the three descriptors.
+  // format the chain, with next as the position in chain[].
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
 
-  if(write)
+  if(bio->write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  chain[0].addr = (uint64) buf0;
+  chain[0].len = sizeof(struct virtio_blk_req);
+  chain[0].flags = VRING_DESC_F_NEXT;
+  chain[0].next = 1;
+
+  // one descriptor per block: the buffers need not be adjacent
+  // in memory, only on disk.
+  for(i = 1; i <= bio->n; i++){
+    chain[i].addr = (uint64) bio->data[i-1];
+    chain[i].len = BSIZE;
+    if(bio->write)
+      chain[i].flags = 0; // device reads the data
+    else
+      chain[i].flags = VRING_DESC_F_WRITE; // device writes the data
+    chain[i].flags |= VRING_DESC_F_NEXT;
+    chain[i].next = i+1;
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  q->info[idx[0]].status = 0xff; // device writes 0 on success
+  chain[n-1].addr = (uint64) &q->info[idx[0]].status;
+  chain[n-1].len = 1;
+  chain[n-1].flags = VRING_DESC_F_WRITE; // device writes the status
+  chain[n-1].next = 0;
+
+  if(disk.indirect){
+    memmove(q->ind[idx[0]], chain, n * sizeof(chain[0]));
+    q->desc[idx[0]].addr = (uint64) q->ind[idx[0]];
+    q->desc[idx[0]].len = n * sizeof(chain[0]);
+    q->desc[idx[0]].flags = VRING_DESC_F_INDIRECT;
+    q->desc[idx[0]].next = 0;
+  } else {
+    for(i = 0; i < n; i++){
+      q->desc[idx[i]] = chain[i];
+      if(i < n-1)
+        q->desc[idx[i]].next = idx[i+1];
+    }
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record struct bio for virtio_disk_intr().
+  q->info[idx[0]].bio = bio;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  q->avail->ring[q->avail->idx % disk.num] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  uint16 old = q->avail->idx;
+  q->avail->idx = old + 1; // not % NUM ...
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  // with EVENT_IDX, a device still working through the ring
+  // will see the new entry without being told.
+  if(!disk.eventidx || need_event(*VQ_AVAIL_EVENT(q->used, disk.num), old + 1, old))
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = q - disk.q; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
-  }
+  release(&q->lock);
+}
+
+// Complete the requests the device has finished on q, passing
+// polled on to bio_endio(). Caller holds q->lock.
+static int
+reap(struct vq *q, int polled)
+{
+  int n = 0;
+
+  // the device increments q->used->idx when it
+  // adds an entry to the used ring.
+
+  do {
+    while(q->used_idx != q->used->idx){
+      __sync_synchronize();
+      int id = q->used->ring[q->used_idx % disk.num].id;
+
+      if(q->info[id].status != 0)
+        panic("virtio_disk_intr status");
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+      struct bio *bio = q->info[id].bio;
+      q->info[id].bio = 0;
+      free_chain(q, id);
+      bio_endio(bio, polled);   // disk is done with the request
+      n++;
 
-  release(&disk.vdisk_lock);
+      q->used_idx += 1;
+    }
+    if(!disk.eventidx)
+      break;
+    // ask for an interrupt at the next completion only; ones
+    // that land before we get here share this interrupt. then
+    // look again, in case one landed before the device saw
+    // the new used_event.
+    *VQ_USED_EVENT(q->avail, disk.num) = q->used_idx;
+    __sync_synchronize();
+  } while(q->used_idx != q->used->idx);
+
+  return n;
 }
 
+// The device has one interrupt for all its queues, so check
+// each of them for completed requests, taking only that
+// queue's lock.
 void
 virtio_disk_intr()
 {
-  acquire(&disk.vdisk_lock);
-
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
   // this may race with the device writing new entries to
@@ -306,22 +465,38 @@ virtio_disk_intr()
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+  for(int i = 0; i < disk.nq; i++){
+    struct vq *q = &disk.q[i];
 
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
+    acquire(&q->lock);
+    reap(q, 0);
+    release(&q->lock);
+  }
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+  // completions made room at the driver for queued requests.
+  blk_run();
+}
 
-    disk.used_idx += 1;
+// Complete whatever the device has finished, without waiting
+// for its interrupt. The interrupt still comes, and finds these
+// requests already done.
+void
+virtio_disk_poll(void)
+{
+  int n = 0;
+
+  for(int i = 0; i < disk.nq; i++){
+    struct vq *q = &disk.q[i];
+
+    // nothing new? then no need for the lock; a racing
+    // completion is found next time round.
+    if(q->used_idx == q->used->idx)
+      continue;
+    acquire(&q->lock);
+    n += reap(q, 1);
+    release(&q->lock);
   }
 
-  release(&disk.vdisk_lock);
+  if(n > 0)
+    blk_run();
 }
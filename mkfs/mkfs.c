@@ -0,0 +1,491 @@
+// Make an xv6 file system image.
+//
+// usage: mkfs [-s blocks] [-l logblocks] [-i inodes] [-b bsize] [-oxda]
+//             fs.img files...
+//
+// Each file goes into the root directory, named by the last
+// element of its path without a leading '_' (user/_cat is cat).
+// A directory is copied with everything below it.
+//
+// The whole image is built in memory and written out at the
+// end in large sequential writes, skipping runs of zeros, so
+// big images are quick to make. Blocks are laid out the way
+// the kernel's allocator would like to find them: each file's
+// content is one contiguous run in the allocation group of its
+// inode, a file's inode is in its directory's group, and a
+// directory's own blocks come just before those of its files.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define stat xv6_stat      // avoid clash with host struct stat
+#define dirent xv6_dirent  // avoid clash with host struct dirent
+#include "kernel/types.h"
+
+// The block size is chosen at run time, so the macros fs.h
+// derives from BSIZE (IPB, BPB, NINDIRECT, ...) use bsize.
+uint bsize = 1024;
+#undef BSIZE
+#define BSIZE bsize
+
+#include "kernel/fs.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#undef stat
+#undef dirent
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define WCHUNK (1024*1024)  // bytes per write of the image
+#define MAXIMAP (4096*8)    // the kernel's inode map is one page of bits
+
+struct superblock sb;
+char *img;                  // the whole image
+char zeroes[WCHUNK];
+uint dstart;                // first data block
+
+// allocation groups, cut as the kernel's bsuminit() and
+// isuminit() cut them.
+uint bpg, ngroup, ipg;
+uint gfree[NGROUP], gifree[NGROUP], nifree;
+uint cursor[NGROUP];        // where the next run in a group is looked for
+
+void die(const char *);
+void error(const char *);
+uint ialloc(ushort type, uint g);
+void iappend(uint inum, int fd, char *p, uint n);
+void mkdirtree(uint inum, uint parent, char **paths, char **names, int n);
+
+static char*
+block(uint b)
+{
+  return img + (uint64)b * bsize;
+}
+
+static struct dinode*
+dinode(uint inum)
+{
+  return (struct dinode*)block(IBLOCK(inum, sb)) + inum % IPB;
+}
+
+static int
+used(uint b)
+{
+  uchar *m = (uchar*)block(BBLOCK(b, sb));
+
+  return m[b % BPB / 8] & (1 << (b % 8));
+}
+
+static void
+setused(uint b)
+{
+  uchar *m = (uchar*)block(BBLOCK(b, sb));
+
+  m[b % BPB / 8] |= 1 << (b % 8);
+  gfree[b / bpg]--;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint nlog, ninodes, nbitmap, ninodeblocks, nmeta, flags, size, b;
+  uint g, ino;
+  int c, fd;
+  uint64 off, n;
+  char *name, **names;
+
+  size = FSSIZE;
+  nlog = LOGSIZE + 1;
+  ninodes = 200;
+  flags = 0;
+  while((c = getopt(argc, argv, "s:l:i:b:oxda")) != -1){
+    switch(c){
+    case 's': size = atoi(optarg); break;
+    case 'l': nlog = atoi(optarg); break;
+    case 'i': ninodes = atoi(optarg); break;
+    case 'b': bsize = atoi(optarg); break;
+    case 'o': flags |= FS_ORDERED; break;
+    case 'x': flags |= FS_EXTENTS; break;
+    case 'd': flags |= FS_DIRINDEX; break;
+    case 'a': flags |= FS_ASYNC; break;
+    default: goto usage;
+    }
+  }
+  if(optind >= argc){
+  usage:
+    fprintf(stderr, "usage: mkfs [-s blocks] [-l logblocks] [-i inodes] [-b bsize]\n"
+                    "            [-o ordered] [-x extents] [-d dirindex] [-a async]\n"
+                    "            fs.img files...\n");
+    exit(1);
+  }
+
+  if(*(ushort*)"\1\0" != 1)
+    error("mkfs writes the image in host byte order, which must be little-endian");
+  if(bsize < 1024 || bsize > 4096 || (bsize & (bsize - 1)) != 0)
+    error("block size must be 1024, 2048 or 4096");
+  if(nlog < LOGSIZE + 1)
+    error("log too small: it needs a header block and LOGSIZE blocks");
+  if(ninodes < ROOTINO + 1 || ninodes > MAXIMAP)
+    error("bad number of inodes");
+
+  nbitmap = (size + BPB - 1) / BPB;
+  ninodeblocks = ninodes / IPB + 1;
+  sb.magic = FSMAGIC;
+  sb.size = size;
+  sb.ninodes = ninodes;
+  sb.nlog = nlog;
+  sb.logstart = (SBOFF + sizeof(sb) + bsize - 1) / bsize;  // after boot and super block
+  sb.inodestart = sb.logstart + nlog;
+  sb.bmapstart = sb.inodestart + ninodeblocks;
+  sb.flags = flags;
+  sb.bsize = bsize;
+  nmeta = sb.bmapstart + nbitmap;
+  if(nmeta >= size)
+    error("file system too small");
+  sb.nblocks = size - nmeta;
+  dstart = nmeta;
+
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, sb.nblocks, size);
+
+  if((img = calloc(size, bsize)) == 0)
+    die("calloc");
+
+  bpg = (size + NGROUP - 1) / NGROUP;
+  ngroup = (size + bpg - 1) / bpg;
+  ipg = (ninodes + ngroup - 1) / ngroup;
+  for(g = 0; g < ngroup; g++){
+    gfree[g] = min((g + 1) * bpg, size) - g * bpg;
+    gifree[g] = min((g + 1) * ipg, ninodes) - min(g * ipg, ninodes);
+    cursor[g] = g * bpg < dstart ? dstart : g * bpg;
+    nifree += gifree[g];
+  }
+  gifree[0]--;   // inode 0 is never used
+  nifree--;
+  for(b = 0; b < dstart; b++)
+    setused(b);
+
+  if((ino = ialloc(T_DIR, 0)) != ROOTINO)
+    error("root inode");
+  if((names = calloc(argc, sizeof(char*))) == 0)
+    die("calloc");
+  for(c = optind + 1; c < argc; c++){
+    name = strrchr(argv[c], '/') ? strrchr(argv[c], '/') + 1 : argv[c];
+    if(*name == '_')
+      name++;
+    names[c - optind - 1] = name;
+  }
+  mkdirtree(ROOTINO, ROOTINO, argv + optind + 1, names, argc - optind - 1);
+
+  memmove(img + SBOFF, &sb, sizeof(sb));
+
+  // write it out in big pieces, leaving holes for the zeros.
+  fd = open(argv[optind], O_RDWR|O_CREAT|O_TRUNC, 0666);
+  if(fd < 0)
+    die(argv[optind]);
+  for(off = 0; off < (uint64)size * bsize; off += n){
+    n = min(WCHUNK, (uint64)size * bsize - off);
+    if(memcmp(img + off, zeroes, n) != 0 && pwrite(fd, img + off, n, off) != n)
+      die("write");
+  }
+  if(ftruncate(fd, (uint64)size * bsize) < 0)
+    die("ftruncate");
+  close(fd);
+  exit(0);
+}
+
+// A host system call failed.
+void
+die(const char *s)
+{
+  perror(s);
+  exit(1);
+}
+
+// The file system can't be made as asked.
+void
+error(const char *s)
+{
+  fprintf(stderr, "mkfs: %s\n", s);
+  exit(1);
+}
+
+// Claim up to want free blocks in a row, preferably the first
+// run of all of them at or after goal. Returns the first block
+// and sets *run to how many were claimed.
+static uint
+balloc(uint goal, uint want, uint *run)
+{
+  uint b, n, first, i;
+
+  first = 0;
+  for(i = 0; i < sb.nblocks; i += n ? n : 1){
+    b = dstart + (goal - dstart + i) % sb.nblocks;
+    for(n = 0; n < want && b + n < sb.size && !used(b + n); n++)
+      ;
+    if(n > 0 && first == 0)
+      first = b;
+    if(n == want)
+      break;
+  }
+  if(i >= sb.nblocks){
+    if(first == 0)
+      error("out of blocks");
+    b = first;
+    for(n = 0; n < want && b + n < sb.size && !used(b + n); n++)
+      ;
+  }
+  for(i = 0; i < n; i++)
+    setused(b + i);
+  *run = n;
+  return b;
+}
+
+// Group for a new directory: the one with the most free blocks
+// among those with an above-average share of free inodes, as
+// the kernel's imapalloc() chooses.
+static uint
+dirgroup(void)
+{
+  uint g, best, bg;
+
+  best = bg = 0;
+  for(g = 0; g < ngroup; g++){
+    if(gifree[g] * ngroup < nifree || gifree[g] == 0)
+      continue;
+    if(gfree[g] >= best){
+      best = gfree[g];
+      bg = g;
+    }
+  }
+  return bg;
+}
+
+// Allocate an inode of the given type, in group g if it has
+// a free one, else in the next group that does.
+uint
+ialloc(ushort type, uint g)
+{
+  uint n, gi, inum, hi;
+  struct dinode *din;
+
+  for(n = 0; n < ngroup; n++){
+    gi = (g + n) % ngroup;
+    if(gifree[gi] == 0)
+      continue;
+    hi = min((gi + 1) * ipg, sb.ninodes);
+    for(inum = gi * ipg; inum < hi; inum++){
+      din = dinode(inum);
+      if(inum == 0 || din->type != 0)
+        continue;
+      din->type = type;
+      din->nlink = 1;
+      if((sb.flags & FS_EXTENTS) && type != T_DEVICE)
+        din->flags = I_EXTENTS;
+      gifree[gi]--;
+      nifree--;
+      return inum;
+    }
+  }
+  error("out of inodes");
+  return 0;
+}
+
+// Map logical block bn of an indirect-mapped inode to disk
+// block addr, allocating indirect blocks near goal.
+static void
+bset(struct dinode *din, uint bn, uint addr, uint goal)
+{
+  uint *slot, lbn, r;
+  uint64 span;
+  int level;
+
+  if(bn < NDIRECT){
+    din->addrs[bn] = addr;
+    return;
+  }
+  lbn = bn - NDIRECT;
+  span = NINDIRECT;
+  for(level = 0; level < NLEVEL; level++){
+    if(lbn < span)
+      break;
+    lbn -= span;
+    span *= NINDIRECT;
+  }
+  if(level == NLEVEL)
+    error("file too big");
+  slot = &din->addrs[NDIRECT+level];
+  do {
+    if(*slot == 0)
+      *slot = balloc(goal, 1, &r);
+    span /= NINDIRECT;
+    slot = (uint*)block(*slot) + lbn / span;
+    lbn %= span;
+  } while(span > 1);
+  *slot = addr;
+}
+
+// Extent slot i of din: NIEXTENT in the inode, then the extent
+// block, which is allocated near goal when first needed.
+static struct extent*
+eslot(struct dinode *din, uint i, uint goal)
+{
+  uint r;
+
+  if(i < NIEXTENT)
+    return (struct extent*)din->addrs + i;
+  if(din->addrs[XBLOCK] == 0)
+    din->addrs[XBLOCK] = balloc(goal, 1, &r);
+  return (struct extent*)block(din->addrs[XBLOCK]) + i - NIEXTENT;
+}
+
+// Map logical blocks [lbn, lbn+n) of din to disk blocks
+// [pbn, pbn+n).
+static void
+imap(struct dinode *din, uint lbn, uint pbn, uint n)
+{
+  struct extent *e;
+  uint i;
+
+  if(din->flags & I_EXTENTS){
+    for(i = 0; i < NIEXTENT + NXEXTENT; i++){
+      e = eslot(din, i, pbn + n);
+      if(e->len == 0){
+        e->lbn = lbn;
+        e->pbn = pbn;
+        e->len = n;
+        return;
+      }
+      if(e->lbn + e->len == lbn && e->pbn + e->len == pbn){
+        e->len += n;
+        return;
+      }
+    }
+    error("out of extents");
+  }
+  for(i = 0; i < n; i++)
+    bset(din, lbn + i, pbn + i, pbn + n);
+}
+
+// Give inode inum n bytes of content, read from fd if it is
+// not -1 and copied from p otherwise, in as few runs of
+// blocks as there is room for.
+void
+iappend(uint inum, int fd, char *p, uint n)
+{
+  struct dinode *din = dinode(inum);
+  uint g, lbn, nb, pbn, run, m, o;
+  int r;
+
+  if(!(din->flags & I_EXTENTS) && n > (uint64)MAXFILE * bsize)
+    error("file too big");
+  g = inum / ipg;
+  nb = (n + bsize - 1) / bsize;
+  for(lbn = 0; lbn < nb; lbn += run){
+    pbn = balloc(cursor[g], nb - lbn, &run);
+    m = min(n - lbn * bsize, run * bsize);
+    if(fd < 0){
+      memmove(block(pbn), p + (uint64)lbn * bsize, m);
+    } else {
+      for(o = 0; o < m; o += r){
+        if((r = read(fd, block(pbn) + o, m - o)) <= 0)
+          die("read");
+      }
+    }
+    imap(din, lbn, pbn, run);
+    if(pbn / bpg == g)
+      cursor[g] = pbn + run;
+  }
+  din->size = n;
+}
+
+// Copy host directory path into inode inum.
+static void
+adddir(uint inum, uint parent, char *path)
+{
+  DIR *d;
+  struct dirent *e;
+  char **paths, **names;
+  int n, i;
+
+  if((d = opendir(path)) == 0)
+    die(path);
+  paths = names = 0;
+  for(n = 0; (e = readdir(d)) != 0; ){
+    if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+      continue;
+    paths = realloc(paths, (n + 1) * sizeof(char*));
+    names = realloc(names, (n + 1) * sizeof(char*));
+    if(paths == 0 || names == 0)
+      die("realloc");
+    names[n] = strdup(e->d_name);
+    if((paths[n] = malloc(strlen(path) + strlen(e->d_name) + 2)) == 0)
+      die("malloc");
+    sprintf(paths[n], "%s/%s", path, e->d_name);
+    n++;
+  }
+  closedir(d);
+  mkdirtree(inum, parent, paths, names, n);
+  for(i = 0; i < n; i++){
+    free(paths[i]);
+    free(names[i]);
+  }
+  free(paths);
+  free(names);
+}
+
+// Fill in directory inum, whose parent is parent, with the n
+// host files or directories paths[], named names[]. The
+// entries' inodes and the directory's blocks are allocated
+// first, then each entry's content, so the directory lies just
+// before what it holds.
+void
+mkdirtree(uint inum, uint parent, char **paths, char **names, int n)
+{
+  struct xv6_dirent *de;
+  struct stat st;
+  uint *child, len;
+  int i, fd;
+
+  len = (n + 2) * sizeof(*de);
+  len = (len + bsize - 1) / bsize * bsize;   // whole blocks, as mkdir leaves them
+  if((de = calloc(1, len)) == 0 || (child = calloc(n + 1, sizeof(uint))) == 0)
+    die("calloc");
+  de[0].inum = inum;
+  strcpy(de[0].name, ".");
+  de[1].inum = parent;
+  strcpy(de[1].name, "..");
+  for(i = 0; i < n; i++){
+    if(strlen(names[i]) > DIRSIZ || strlen(names[i]) == 0)
+      error("file name too long");
+    if(stat(paths[i], &st) < 0)
+      die(paths[i]);
+    if(S_ISDIR(st.st_mode)){
+      child[i] = ialloc(T_DIR, dirgroup());
+      dinode(inum)->nlink++;   // its ".."
+    } else {
+      child[i] = ialloc(T_FILE, inum / ipg);
+    }
+    de[i+2].inum = child[i];
+    strncpy(de[i+2].name, names[i], DIRSIZ);
+  }
+  iappend(inum, -1, (char*)de, len);
+
+  for(i = 0; i < n; i++){
+    if(dinode(child[i])->type == T_DIR){
+      adddir(child[i], inum, paths[i]);
+      continue;
+    }
+    if((fd = open(paths[i], O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+      die(paths[i]);
+    iappend(child[i], fd, 0, st.st_size);
+    close(fd);
+  }
+  free(de);
+  free(child);
+}
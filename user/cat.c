@@ -2,13 +2,23 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
-char buf[512];
+// page-aligned and page-sized, so that the kernel can move
+// whole cached blocks into it rather than copy them.
+char buf[4096] __attribute__((aligned(4096)));
 
 void
 cat(int fd)
 {
   int n;
 
+  // file to file or pipe: let the kernel move the data.
+  // sendfile fails at once for anything else, and we fall
+  // back to copying through buf.
+  while((n = sendfile(1, fd, -1, sizeof(buf))) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
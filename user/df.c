@@ -0,0 +1,33 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Print the size and free space of the file system
+// holding each argument, or holding / if none given.
+
+void
+df(char *path)
+{
+  struct statfs st;
+
+  if(statfs(path, &st) < 0){
+    fprintf(2, "df: cannot statfs %s\n", path);
+    return;
+  }
+  printf("%s: %d blocks of %d bytes, %d free, %d inodes, %d free, %d groups\n",
+         path, st.blocks, st.bsize, st.bfree, st.files, st.ffree, st.ngroup);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc < 2){
+    df("/");
+    exit(0);
+  }
+  for(i = 1; i < argc; i++)
+    df(argv[i]);
+  exit(0);
+}
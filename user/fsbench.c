@@ -0,0 +1,137 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// File system benchmark.
+// fsbench [n [kb]]: make n names in a fresh directory, look each
+// of them up, then remove them; then write a kb-kilobyte file
+// sequentially and read it back. Prints the ticks each took.
+// The names are links to one file, so n is not limited by
+// the number of free inodes. Compare kernels built with
+// FSBSIZE=1024 and FSBSIZE=4096 to see what the block size costs.
+
+#define DIR "fsb"
+
+char path[32];
+char buf[8192];
+
+// Set path to DIR/f<i>.
+void
+mkname(int i)
+{
+  char num[12];
+  int n, k;
+
+  n = 0;
+  do {
+    num[n++] = '0' + i % 10;
+    i /= 10;
+  } while(i > 0);
+  strcpy(path, DIR "/f");
+  k = strlen(path);
+  while(n > 0)
+    path[k++] = num[--n];
+  path[k] = '\0';
+}
+
+// Write kb kilobytes to DIR/data in 8 KB writes, then read
+// them back.
+void
+io(int kb)
+{
+  int fd, i, n, t0, t;
+  struct statfs st;
+
+  if(statfs(DIR, &st) == 0)
+    printf("block size %d\n", st.bsize);
+  if((fd = open(DIR "/data", O_CREATE|O_RDWR)) < 0){
+    fprintf(2, "fsbench: cannot create %s/data\n", DIR);
+    exit(1);
+  }
+  memset(buf, 'b', sizeof(buf));
+  t0 = uptime();
+  for(i = 0; i < kb; i += sizeof(buf) / 1024){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "fsbench: write failed at %d KB\n", i);
+      kb = i;
+      break;
+    }
+  }
+  close(fd);
+  t = uptime() - t0;
+  printf("write %d KB: %d ticks (%d KB/tick)\n", kb, t, kb / (t ? t : 1));
+
+  if((fd = open(DIR "/data", O_RDONLY)) < 0){
+    fprintf(2, "fsbench: cannot open %s/data\n", DIR);
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; (n = read(fd, buf, sizeof(buf))) > 0; i += n)
+    ;
+  close(fd);
+  t = uptime() - t0;
+  printf("read %d KB: %d ticks (%d KB/tick)\n", i / 1024, t, i / 1024 / (t ? t : 1));
+  unlink(DIR "/data");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, fd, t0, kb;
+
+  n = 10000;
+  kb = 512;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    kb = atoi(argv[2]);
+
+  if(mkdir(DIR) < 0){
+    fprintf(2, "fsbench: cannot mkdir %s\n", DIR);
+    exit(1);
+  }
+  if((fd = open(DIR "/target", O_CREATE|O_RDWR)) < 0){
+    fprintf(2, "fsbench: cannot create %s/target\n", DIR);
+    exit(1);
+  }
+  close(fd);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if(link(DIR "/target", path) < 0){
+      fprintf(2, "fsbench: link %s failed\n", path);
+      n = i;
+      break;
+    }
+  }
+  printf("create %d names: %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      fprintf(2, "fsbench: open %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  printf("lookup %d names: %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if(unlink(path) < 0){
+      fprintf(2, "fsbench: unlink %s failed\n", path);
+      exit(1);
+    }
+  }
+  printf("unlink %d names: %d ticks\n", n, uptime() - t0);
+
+  io(kb);
+
+  unlink(DIR "/target");
+  unlink(DIR);
+  exit(0);
+}
@@ -0,0 +1,83 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+// Print block I/O counters and latency histograms for each
+// device given, or for every device that has done any I/O.
+
+char *origins[] = {
+  [IO_META] "meta",
+  [IO_LOG]  "log",
+  [IO_DATA] "data",
+};
+
+char *classes[] = {
+  [IOPRIO_RT]   "rt",
+  [IOPRIO_BE]   "be",
+  [IOPRIO_IDLE] "idle",
+};
+
+// one histogram on one line, counts for buckets 1us, 2us, 4us...
+// up to the last non-empty one.
+void
+hist(char *name, uint *h)
+{
+  int i, last;
+
+  for(last = NIOHIST-1; last >= 0 && h[last] == 0; last--)
+    ;
+  if(last < 0)
+    return;
+  printf("  %s:", name);
+  for(i = 0; i <= last; i++)
+    printf(" %d", h[i]);
+  printf("\n");
+}
+
+void
+iostat1(int dev, int quiet)
+{
+  struct iostat st;
+  int i;
+
+  if(iostat(dev, &st) < 0){
+    fprintf(2, "iostat: no device %d\n", dev);
+    return;
+  }
+  if(quiet && st.reads + st.writes + st.queued + st.inflight == 0)
+    return;
+  printf("disk %d: %d reads %d sectors, %d writes %d sectors, %d merged\n",
+         dev, st.reads, st.rsectors, st.writes, st.wsectors, st.merges);
+  printf("  %d queued, %d at driver, busy %lu us\n",
+         st.queued, st.inflight, st.busy);
+  for(i = 0; i < NIOORIGIN; i++)
+    printf("  %s %d", origins[i], st.origin[i]);
+  printf("\n");
+  for(i = 0; i < NIOPRIO; i++){
+    if(st.prio[i] == 0)
+      continue;
+    printf("  %s %d, avg %d us, max %d us\n", classes[i], st.prio[i],
+           st.priotime[i] / st.prio[i], st.priomax[i]);
+  }
+  printf("  latency histograms, buckets of 2^i us:\n");
+  for(i = 0; i < NIOORIGIN; i++)
+    hist(origins[i], st.hist[i]);
+  hist("intr", st.intrhist);
+  hist("polled", st.pollhist);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc < 2){
+    for(i = 0; i < NDISK; i++)
+      iostat1(i, 1);
+    exit(0);
+  }
+  for(i = 1; i < argc; i++)
+    iostat1(atoi(argv[i]), 0);
+  exit(0);
+}
@@ -1,4 +1,7 @@
 struct stat;
+struct statfs;
+struct iovec;
+struct iostat;
 
 // system calls
 int fork(void);
@@ -22,6 +25,22 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int statfs(const char*, struct statfs*);
+int sendfile(int, int, int, int);
+int splice(int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int lseek(int, int, int);
+int fallocate(int, int, int);
+int fsync(int);
+int fdatasync(int);
+int sync(void);
+int ioprio(int);
+int iopoll(int);
+int iostat(int, struct iostat*);
+int mount(const char*, const char*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uio.h"
+#include "kernel/iostat.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -582,6 +584,9 @@ void
 writebig(char *s)
 {
   int i, fd, n;
+  // MAXFILE is far beyond the disk now; go just past the
+  // single indirect block into the double-indirect tree.
+  int nblocks = NDIRECT + NINDIRECT + 64;
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
@@ -589,7 +594,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < nblocks; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -609,7 +614,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n != MAXFILE){
+      if(n != nblocks){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -1781,6 +1786,742 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// does statfs() account for blocks a file takes and gives back?
+void
+statfstest(char *s)
+{
+  enum { N = 16 };
+  struct statfs st0, st1, st2;
+  int fd, i;
+
+  unlink("statfs.dat");
+  if(statfs("/", &st0) < 0){
+    printf("%s: statfs / failed\n", s);
+    exit(1);
+  }
+  if(st0.bsize != BSIZE || st0.bfree == 0 || st0.bfree > st0.blocks){
+    printf("%s: statfs bad totals %d %d\n", s, st0.blocks, st0.bfree);
+    exit(1);
+  }
+  fd = open("statfs.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create statfs.dat\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write statfs.dat failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(statfs("statfs.dat", &st1) < 0){
+    printf("%s: statfs statfs.dat failed\n", s);
+    exit(1);
+  }
+  if(st1.ffree != st0.ffree - 1){
+    printf("%s: free inodes %d after create, was %d\n", s, st1.ffree, st0.ffree);
+    exit(1);
+  }
+  if(st0.bfree - st1.bfree < N){
+    printf("%s: %d blocks written, free count fell by %d\n", s, N, st0.bfree - st1.bfree);
+    exit(1);
+  }
+  unlink("statfs.dat");
+  if(statfs("/", &st2) < 0 || st2.bfree - st1.bfree < N){
+    printf("%s: free count %d after unlink, was %d\n", s, st2.bfree, st1.bfree);
+    exit(1);
+  }
+  if(st2.ffree != st0.ffree){
+    printf("%s: free inodes %d after unlink, was %d\n", s, st2.ffree, st0.ffree);
+    exit(1);
+  }
+  if(statfs("nonexistent", &st2) == 0){
+    printf("%s: statfs of nonexistent path succeeded\n", s);
+    exit(1);
+  }
+}
+
+// page-aligned whole-page reads may hand the kernel's cached
+// copy of a block to the reader instead of copying it. the data
+// must be right, must stay right for the next reader, and the
+// reader must be able to scribble on what it got.
+void
+pageread(char *s)
+{
+  enum { NPG = 4 };
+  char *p;
+  int fd, i, j, pass;
+
+  unlink("pageread.dat");
+  fd = open("pageread.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create pageread.dat\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NPG; i++){
+    memset(buf, 'a' + i, PGSIZE);
+    if(write(fd, buf, PGSIZE) != PGSIZE){
+      printf("%s: write pageread.dat failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // push pageread.dat out of the buffer cache, so the first
+  // pass reads it from disk; only such blocks are moved into
+  // user pages, and only if BSIZE is PGSIZE (make FSBSIZE=4096).
+  // the second pass finds what is left in the cache and copies.
+  unlink("pageread.big");
+  fd = open("pageread.big", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create pageread.big\n", s);
+    exit(1);
+  }
+  memset(buf, 0, BSIZE);
+  for(i = 0; i < 2*NBUF; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write pageread.big failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("pageread.big");
+
+  p = sbrk(0);
+  p = sbrk((PGSIZE - (uint64)p % PGSIZE) % PGSIZE + NPG*PGSIZE);
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  p += (PGSIZE - (uint64)p % PGSIZE) % PGSIZE;
+
+  for(pass = 0; pass < 2; pass++){
+    fd = open("pageread.dat", O_RDONLY);
+    if(fd < 0 || read(fd, p, NPG*PGSIZE) != NPG*PGSIZE){
+      printf("%s: read pageread.dat failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    for(i = 0; i < NPG; i++){
+      for(j = 0; j < PGSIZE; j++){
+        if(p[i*PGSIZE + j] != 'a' + i){
+          printf("%s: pass %d: wrong byte at %d\n", s, pass, i*PGSIZE + j);
+          exit(1);
+        }
+      }
+    }
+    memset(p, 'z', NPG*PGSIZE);
+  }
+  unlink("pageread.dat");
+}
+
+// sendfile and splice move data between files and pipes in the
+// kernel. the data must come out the same as read() would see it.
+void
+sendfiletest(char *s)
+{
+  enum { N = 3000 };
+  int fd, out, p[2], pid, i, n, xst;
+  char c;
+
+  unlink("sendfile.in");
+  unlink("sendfile.out");
+  fd = open("sendfile.in", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create sendfile.in\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    buf[i] = i % 251;
+  if(write(fd, buf, N) != N){
+    printf("%s: write sendfile.in failed\n", s);
+    exit(1);
+  }
+
+  // file to file from an explicit offset leaves fd's offset alone.
+  out = open("sendfile.out", O_CREATE | O_RDWR);
+  if(out < 0 || sendfile(out, fd, 100, N) != N - 100){
+    printf("%s: sendfile to file failed\n", s);
+    exit(1);
+  }
+  if(read(fd, &c, 1) != 0){
+    printf("%s: sendfile moved the offset\n", s);
+    exit(1);
+  }
+  close(out);
+  out = open("sendfile.out", O_RDONLY);
+  memset(buf, 0, N);
+  if(read(out, buf, N) != N - 100){
+    printf("%s: sendfile.out has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N - 100; i++){
+    if((uchar)buf[i] != (i + 100) % 251){
+      printf("%s: sendfile.out wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(out);
+
+  // file to pipe, more than the pipe holds at once.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[1]);
+    for(i = 0; (n = read(p[0], &c, 1)) == 1; i++){
+      if((uchar)c != i % 251)
+        exit(1);
+    }
+    exit(i == N ? 0 : 1);
+  }
+  close(p[0]);
+  if(sendfile(p[1], fd, 0, N) != N){
+    printf("%s: sendfile to pipe failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: pipe reader saw the wrong data\n", s);
+    exit(1);
+  }
+
+  // pipe to file.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    for(i = 0; i < N; i++)
+      buf[i] = i % 251;
+    write(p[1], buf, N);
+    exit(0);
+  }
+  close(p[1]);
+  out = open("sendfile.out", O_CREATE | O_TRUNC | O_RDWR);
+  if(out < 0 || splice(p[0], out, N + 1) != N){
+    printf("%s: splice from pipe failed\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  wait(0);
+  close(out);
+  out = open("sendfile.out", O_RDONLY);
+  memset(buf, 0, N);
+  if(read(out, buf, N + 1) != N){
+    printf("%s: spliced file has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if((uchar)buf[i] != i % 251){
+      printf("%s: spliced file wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(out);
+  close(fd);
+  unlink("sendfile.in");
+  unlink("sendfile.out");
+}
+
+// pread/pwrite at explicit offsets, and readv/writev spreading
+// one file range over several buffers.
+void
+preadv(char *s)
+{
+  int fd, i;
+  char hdr[8], tail[8];
+  struct iovec iov[3];
+
+  unlink("preadv.dat");
+  fd = open("preadv.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create preadv.dat\n", s);
+    exit(1);
+  }
+
+  // header, a payload that crosses a block boundary, trailer.
+  memset(hdr, 'h', sizeof(hdr));
+  for(i = 0; i < BSIZE + 100; i++)
+    buf[i] = 'a' + i % 26;
+  memset(tail, 't', sizeof(tail));
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = buf;
+  iov[1].iov_len = BSIZE + 100;
+  iov[2].iov_base = tail;
+  iov[2].iov_len = sizeof(tail);
+  if(writev(fd, iov, 3) != sizeof(hdr) + BSIZE + 100 + sizeof(tail)){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+
+  // pwrite/pread do not move the descriptor's offset.
+  if(pwrite(fd, "XY", 2, 8) != 2 || pread(fd, tail, 4, 6) != 4){
+    printf("%s: pwrite/pread failed\n", s);
+    exit(1);
+  }
+  if(memcmp(tail, "hhXY", 4) != 0){
+    printf("%s: pread saw the wrong data\n", s);
+    exit(1);
+  }
+  if(read(fd, tail, 1) != 0){
+    printf("%s: pread/pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, tail, 4, -1) != -1){
+    printf("%s: pread at a negative offset succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("preadv.dat", O_RDONLY);
+  memset(hdr, 0, sizeof(hdr));
+  memset(buf, 0, BSIZE + 100);
+  memset(tail, 0, sizeof(tail));
+  iov[1].iov_len = BSIZE + 200;   // longer than what is left
+  if(readv(fd, iov, 3) != sizeof(hdr) + BSIZE + 100 + sizeof(tail)){
+    printf("%s: readv returned the wrong count\n", s);
+    exit(1);
+  }
+  if(memcmp(hdr, "hhhhhhhh", 8) != 0 || tail[0] != 0){
+    printf("%s: readv filled the wrong buffers\n", s);
+    exit(1);
+  }
+  // the payload, with pwrite's bytes at its start, then the
+  // trailer, all in the second buffer.
+  if(buf[0] != 'X' || buf[1] != 'Y'){
+    printf("%s: readv lost the pwrite\n", s);
+    exit(1);
+  }
+  for(i = 2; i < BSIZE + 100 + 8; i++){
+    if(buf[i] != (i < BSIZE + 100 ? 'a' + i % 26 : 't')){
+      printf("%s: readv wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("preadv.dat");
+}
+
+// a write past the end leaves a hole that reads as zeros and
+// takes no blocks; fallocate takes the blocks up front.
+void
+sparse(char *s)
+{
+  enum { HOLE = 5*BSIZE + 10, N = 8 };
+  struct statfs st0, st1;
+  struct stat st;
+  int fd, i;
+
+  unlink("sparse.dat");
+  fd = open("sparse.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create sparse.dat\n", s);
+    exit(1);
+  }
+  statfs("/", &st0);
+  if(lseek(fd, HOLE, SEEK_SET) != HOLE || write(fd, "x", 1) != 1){
+    printf("%s: write past the end failed\n", s);
+    exit(1);
+  }
+  statfs("/", &st1);
+  if(st0.bfree - st1.bfree > 2){
+    printf("%s: hole took %d blocks\n", s, st0.bfree - st1.bfree);
+    exit(1);
+  }
+  if(lseek(fd, 0, SEEK_END) != HOLE + 1 || lseek(fd, -HOLE - 1, SEEK_CUR) != 0){
+    printf("%s: lseek returned the wrong offset\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -1, SEEK_SET) != -1){
+    printf("%s: lseek before the start succeeded\n", s);
+    exit(1);
+  }
+  memset(buf, 'z', HOLE + 1);
+  if(read(fd, buf, HOLE + 1) != HOLE + 1){
+    printf("%s: read of the hole failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < HOLE; i++){
+    if(buf[i] != 0){
+      printf("%s: hole byte %d is not zero\n", s, i);
+      exit(1);
+    }
+  }
+  if(buf[HOLE] != 'x'){
+    printf("%s: lost the byte after the hole\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sparse.dat");
+
+  fd = open("sparse.dat", O_CREATE | O_RDWR);
+  statfs("/", &st0);
+  if(fallocate(fd, 0, N*BSIZE) != 0){
+    printf("%s: fallocate failed\n", s);
+    exit(1);
+  }
+  statfs("/", &st1);
+  if(fstat(fd, &st) < 0 || st.size != N*BSIZE || st0.bfree - st1.bfree < N){
+    printf("%s: fallocate did not take the blocks\n", s);
+    exit(1);
+  }
+  memset(buf, 'y', N*BSIZE);
+  if(write(fd, buf, N*BSIZE) != N*BSIZE){
+    printf("%s: write into fallocated blocks failed\n", s);
+    exit(1);
+  }
+  statfs("/", &st0);
+  if(st0.bfree != st1.bfree){
+    printf("%s: write into fallocated blocks allocated more\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sparse.dat");
+}
+
+void
+fsynctest(char *s)
+{
+  struct iostat before, after;
+  int fd, p[2];
+
+  if(iostat(ROOTDEV, &before) < 0){
+    printf("%s: iostat failed\n", s);
+    exit(1);
+  }
+  unlink("fsync.dat");
+  fd = open("fsync.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create fsync.dat\n", s);
+    exit(1);
+  }
+  memset(buf, 'f', BSIZE);
+  if(write(fd, buf, BSIZE) != BSIZE){
+    printf("%s: write fsync.dat failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0 || fdatasync(fd) != 0 || sync() != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  // even with FS_ASYNC, the block is on the disk now.
+  iostat(ROOTDEV, &after);
+  if(after.origin[IO_DATA] <= before.origin[IO_DATA] ||
+     after.wsectors - before.wsectors < BSIZE/512){
+    printf("%s: fsync did not write the data\n", s);
+    exit(1);
+  }
+  // again, with nothing left to commit.
+  if(fsync(fd) != 0){
+    printf("%s: second fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsync.dat");
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(p[1]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+}
+
+// write nblocks blocks of c to a new file name.
+static void
+iofill(char *s, char *name, int nblocks, int c)
+{
+  int fd, i;
+
+  unlink(name);
+  fd = open(name, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create %s\n", s, name);
+    exit(1);
+  }
+  memset(buf, c, BSIZE);
+  for(i = 0; i < nblocks; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// read all of name, passes times, and return the mean latency
+// of the best-effort requests on the root disk meanwhile, in
+// microseconds.
+static uint
+iobelat(char *s, char *name, int passes)
+{
+  struct iostat st0, st1;
+  uint n;
+  int fd, i;
+
+  if(iostat(ROOTDEV, &st0) < 0){
+    printf("%s: iostat failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < passes; i++){
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("%s: cannot open %s\n", s, name);
+      exit(1);
+    }
+    while(read(fd, buf, BSIZE) == BSIZE)
+      ;
+    close(fd);
+  }
+  iostat(ROOTDEV, &st1);
+  n = st1.prio[IOPRIO_BE] - st0.prio[IOPRIO_BE];
+  return (st1.priotime[IOPRIO_BE] - st0.priotime[IOPRIO_BE]) / (n ? n : 1);
+}
+
+// I/O priority classes: the default, inheritance by fork(), and
+// a best-effort reader's latency while an idle-class child keeps
+// the disk busy. Both files are bigger than the buffer cache, so
+// every pass reads from the disk.
+void
+iopriotest(char *s)
+{
+  enum { NB = 4*NBUF, PASSES = 4 };
+  int pid, xstatus;
+  uint base, loaded;
+
+  if(ioprio(-1) != IOPRIO_BE){
+    printf("%s: default class is not best effort\n", s);
+    exit(1);
+  }
+  if(ioprio(NIOPRIO) != -1 || ioprio(-2) != -1){
+    printf("%s: bad class accepted\n", s);
+    exit(1);
+  }
+  iofill(s, "ioprio.fg", NB, 'f');
+  iofill(s, "ioprio.bg", NB, 'b');
+  base = iobelat(s, "ioprio.fg", PASSES);
+
+  if(ioprio(IOPRIO_IDLE) != IOPRIO_BE){
+    printf("%s: ioprio did not return the old class\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(ioprio(-1) != IOPRIO_IDLE){
+      printf("%s: child did not inherit class\n", s);
+      exit(1);
+    }
+    // keep the disk busy until killed.
+    for(;;)
+      iobelat(s, "ioprio.bg", 1);
+  }
+  ioprio(IOPRIO_BE);
+  sleep(1);
+  loaded = iobelat(s, "ioprio.fg", PASSES);
+  kill(pid);
+  wait(&xstatus);
+  unlink("ioprio.fg");
+  unlink("ioprio.bg");
+
+  // an idle-class request at the driver can hold up each of ours
+  // by about one request's time, but no more.
+  if(loaded > 3*base + 2000){
+    printf("%s: best-effort latency %dus under an idle reader, %dus alone\n",
+           s, loaded, base);
+    exit(1);
+  }
+}
+
+// every completion polling mode must still complete reads and
+// writes.
+void
+iopolltest(char *s)
+{
+  int fd, i, mode, old;
+
+  old = iopoll(-1);
+  if(old < IOPOLL_NEVER || old > IOPOLL_ALL){
+    printf("%s: bad polling mode %d\n", s, old);
+    exit(1);
+  }
+  if(iopoll(IOPOLL_ALL+1) != -1){
+    printf("%s: bad mode accepted\n", s);
+    exit(1);
+  }
+  for(mode = IOPOLL_NEVER; mode <= IOPOLL_ALL; mode++){
+    iopoll(mode);
+    unlink("iopoll.dat");
+    fd = open("iopoll.dat", O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: cannot create iopoll.dat\n", s);
+      exit(1);
+    }
+    memset(buf, 'a' + mode, BSIZE);
+    for(i = 0; i < 8; i++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("%s: write failed in mode %d\n", s, mode);
+        exit(1);
+      }
+    }
+    fsync(fd);
+    close(fd);
+    fd = open("iopoll.dat", O_RDONLY);
+    for(i = 0; i < 8; i++){
+      if(read(fd, buf, BSIZE) != BSIZE || buf[BSIZE-1] != 'a' + mode){
+        printf("%s: read failed in mode %d\n", s, mode);
+        exit(1);
+      }
+    }
+    close(fd);
+    unlink("iopoll.dat");
+  }
+  iopoll(old);
+}
+
+// iostat() counts the writes of a synced file, as data and log.
+void
+iostattest(char *s)
+{
+  struct iostat before, after;
+  int fd;
+
+  if(iostat(NDISK, &before) != -1 || iostat(-1, &before) != -1){
+    printf("%s: iostat of a bad device succeeded\n", s);
+    exit(1);
+  }
+  if(iostat(ROOTDEV, &before) < 0 || iostat(RAMDEV, &after) < 0){
+    printf("%s: iostat failed\n", s);
+    exit(1);
+  }
+  unlink("iostat.dat");
+  fd = open("iostat.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create iostat.dat\n", s);
+    exit(1);
+  }
+  memset(buf, 's', BSIZE);
+  if(write(fd, buf, BSIZE) != BSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  fsync(fd);
+  close(fd);
+  unlink("iostat.dat");
+  if(iostat(ROOTDEV, &after) < 0){
+    printf("%s: iostat failed\n", s);
+    exit(1);
+  }
+  if(after.writes <= before.writes || after.wsectors <= before.wsectors ||
+     after.origin[IO_LOG] <= before.origin[IO_LOG]){
+    printf("%s: writes not counted\n", s);
+    exit(1);
+  }
+}
+
+// files on the tmpfs at /tmp, which init mounts: reading back
+// what was written, directories, and ".." out of the mount.
+void
+tmpfstest(char *s)
+{
+  struct stat st;
+  struct statfs sfs;
+  int fd, i;
+
+  if(stat("/tmp", &st) < 0 || st.type != T_DIR || st.dev != TMPDEV){
+    printf("%s: /tmp is not a mounted tmpfs\n", s);
+    exit(1);
+  }
+  if(mount("tmpfs", "/tmp") == 0 || mount("nosuchfs", "/") == 0 ||
+     mount("xv6fs", "/") == 0){
+    printf("%s: bad mount succeeded\n", s);
+    exit(1);
+  }
+
+  fd = open("/tmp/tmpfs.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create /tmp/tmpfs.dat\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    memset(buf, 'a' + i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  // a hole, then one more block.
+  if(lseek(fd, 20*BSIZE, SEEK_SET) != 20*BSIZE || write(fd, buf, BSIZE) != BSIZE){
+    printf("%s: write past a hole failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("/tmp/tmpfs.dat", O_RDONLY);
+  for(i = 0; i < 21; i++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    if(buf[0] != (i < 10 ? 'a' + i : i < 20 ? 0 : 'j') || buf[BSIZE-1] != buf[0]){
+      printf("%s: wrong data in block %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(link("/tmp/tmpfs.dat", "tmpfs.lnk") == 0){
+    printf("%s: link across file systems succeeded\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/tmpfs.dat") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+
+  if(mkdir("/tmp/tmpfs.d") < 0 || chdir("/tmp/tmpfs.d") < 0){
+    printf("%s: mkdir in /tmp failed\n", s);
+    exit(1);
+  }
+  if(chdir("../..") < 0 || stat(".", &st) < 0 || st.dev != ROOTDEV || st.ino != ROOTINO){
+    printf("%s: .. did not leave the mount\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/tmpfs.d") < 0){
+    printf("%s: rmdir failed\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp") == 0){
+    printf("%s: unlinked the mount point\n", s);
+    exit(1);
+  }
+  if(statfs("/tmp", &sfs) < 0 || sfs.bfree == 0){
+    printf("%s: statfs /tmp failed\n", s);
+    exit(1);
+  }
+}
+
 void
 fourteen(char *s)
 {
@@ -2628,6 +3369,16 @@ struct test {
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
+  {statfstest, "statfstest"},
+  {pageread, "pageread"},
+  {sendfiletest, "sendfile"},
+  {preadv, "preadv"},
+  {sparse, "sparse"},
+  {fsynctest, "fsync"},
+  {iopriotest, "ioprio"},
+  {iopolltest, "iopoll"},
+  {iostattest, "iostat"},
+  {tmpfstest, "tmpfs"},
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
@@ -2699,6 +3450,90 @@ bigdir(char *s)
   }
 }
 
+// a directory that outgrows one block, and so is indexed,
+// must still find every name, and must still read as a plain
+// array of dirents. needs FS_DIRINDEX, which MNTFLAGS turns on.
+void
+dirindex(char *s)
+{
+  enum { N = 400 };
+  int i, fd, n;
+  char name[16];
+  struct dirent de;
+  struct statfs st;
+
+  if(statfs("/", &st) < 0 || (st.flags & FS_DIRINDEX) == 0){
+    printf("%s: / lacks FS_DIRINDEX, see MNTFLAGS\n", s);
+    exit(1);
+  }
+
+  unlink("dxd/f");
+  unlink("dxd");
+  if(mkdir("dxd") != 0){
+    printf("%s: mkdir dxd failed\n", s);
+    exit(1);
+  }
+  fd = open("dxd/f", O_CREATE);
+  if(fd < 0){
+    printf("%s: create dxd/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  name[0] = 'd'; name[1] = 'x'; name[2] = 'd'; name[3] = '/';
+  for(i = 0; i < N; i++){
+    name[4] = 'a' + i % 26;
+    name[5] = '0' + (i / 26) % 10;
+    name[6] = '0' + i / 260;
+    name[7] = '\0';
+    if(link("dxd/f", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[4] = 'a' + i % 26;
+    name[5] = '0' + (i / 26) % 10;
+    name[6] = '0' + i / 260;
+    if((fd = open(name, 0)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  if(open("dxd/zz", 0) >= 0){
+    printf("%s: open of missing name succeeded\n", s);
+    exit(1);
+  }
+
+  // count the names as ls would see them.
+  fd = open("dxd", 0);
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum != 0)
+      n++;
+  }
+  close(fd);
+  if(n != N + 3){
+    printf("%s: read %d entries from dxd, expected %d\n", s, n, N + 3);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[4] = 'a' + i % 26;
+    name[5] = '0' + (i / 26) % 10;
+    name[6] = '0' + i / 260;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("dxd/f") != 0 || unlink("dxd") != 0){
+    printf("%s: unlink dxd failed\n", s);
+    exit(1);
+  }
+}
+
 // concurrent writes to try to provoke deadlock in the virtio disk
 // driver.
 void
@@ -2852,7 +3687,6 @@ diskfull(char *s)
       break;
     }
     for(int i = 0; i < MAXFILE; i++){
-      char buf[BSIZE];
       if(write(fd, buf, BSIZE) != BSIZE){
         done = 1;
         close(fd);
@@ -2941,6 +3775,7 @@ outofinodes(char *s)
 
 struct test slowtests[] = {
   {bigdir, "bigdir"},
+  {dirindex, "dirindex"},
   {manywrites, "manywrites"},
   {badwrite, "badwrite" },
   {execout, "execout"},
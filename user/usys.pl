@@ -36,3 +36,19 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("statfs");
+entry("sendfile");
+entry("splice");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("lseek");
+entry("fallocate");
+entry("fsync");
+entry("fdatasync");
+entry("sync");
+entry("ioprio");
+entry("iopoll");
+entry("iostat");
+entry("mount");